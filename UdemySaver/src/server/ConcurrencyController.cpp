@@ -0,0 +1,99 @@
+#include "ConcurrencyController.h"
+
+#include <algorithm>
+
+namespace {
+	constexpr double kEpochSec = 5.0;
+	constexpr double kMinGain = 1.05;      // a probe must add 5% to be kept
+	constexpr double kCollapse = 0.6;      // losing 40% at the same limit is congestion
+	constexpr int kHoldEpochs = 6;         // after a failed probe, sit still ~30 s
+	constexpr int kSegmentBudget = 16;     // connections shared by all transfers
+	constexpr size_t kMaxDecisions = 64;
+}
+
+ConcurrencyController::ConcurrencyController(int min_limit, int max_limit)
+	: min_(std::max(1, min_limit)), max_(std::max(min_, max_limit)), limit_(min_) {
+}
+
+void ConcurrencyController::set_max(int max_limit) {
+	max_ = std::max(min_, max_limit);
+	limit_ = std::min(limit_, max_);
+}
+
+int ConcurrencyController::segments_per_file() const noexcept {
+	return std::clamp(kSegmentBudget / std::max(1, limit_), 1, 8);
+}
+
+bool ConcurrencyController::sample(double now, long long bytes, double dt, int active) {
+	if (epoch_start_ <= 0.0) epoch_start_ = now;
+	epoch_bytes_ += bytes;
+	epoch_dt_ += dt;
+	epoch_active_ += active * dt;
+
+	if (now - epoch_start_ < kEpochSec || epoch_dt_ <= 0.0) return false;
+
+	double bps = epoch_bytes_ / epoch_dt_;
+	double avg_active = epoch_active_ / epoch_dt_;
+	epoch_start_ = now;
+	epoch_bytes_ = 0;
+	epoch_dt_ = 0.0;
+	epoch_active_ = 0.0;
+
+	int before = limit_;
+	decide(now, bps, avg_active);
+	last_bps_ = bps;
+	return limit_ != before;
+}
+
+void ConcurrencyController::decide(double now, double bps, double avg_active) {
+	const bool saturated = avg_active >= limit_ - 0.5;
+
+	if (congestion_ > 0 || (saturated && !probing_ && prev_bps_ > 0.0 && bps < prev_bps_ * kCollapse))
+	{
+		limit_ = std::max(min_, limit_ / 2);
+		probing_ = false;
+		hold_ = kHoldEpochs;
+		record(now, bps, avg_active, congestion_ > 0 ? "congestion" : "collapse");
+		congestion_ = 0;
+	}
+	else if (!saturated)
+	{
+		// not enough ready work to fill the slots; nothing to learn
+		probing_ = false;
+	}
+	else if (probing_ && bps < prev_bps_ * kMinGain)
+	{
+		limit_ = std::max(min_, limit_ - 1);
+		probing_ = false;
+		hold_ = kHoldEpochs;
+		record(now, bps, avg_active, "no gain");
+	}
+	else if (hold_ > 0)
+	{
+		--hold_;
+		probing_ = false;
+	}
+	else if (limit_ < max_)
+	{
+		++limit_;
+		probing_ = true;
+		record(now, bps, avg_active, "probe");
+	}
+	else
+	{
+		probing_ = false;
+	}
+
+	prev_bps_ = bps;
+}
+
+void ConcurrencyController::record(double now, double bps, double avg_active, const char* reason) {
+	Decision d;
+	d.ts = now;
+	d.limit = limit_;
+	d.bps = bps;
+	d.per_transfer = avg_active > 0.0 ? bps / avg_active : 0.0;
+	d.reason = reason;
+	decisions_.push_back(std::move(d));
+	if (decisions_.size() > kMaxDecisions) decisions_.pop_front();
+}
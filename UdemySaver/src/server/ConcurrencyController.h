@@ -0,0 +1,60 @@
+#pragma once
+
+#include <deque>
+#include <string>
+
+// AIMD limit on the number of concurrent transfers.
+// Fed one aggregate throughput sample per second by RequestHandler. Once per
+// epoch it probes one slot up while that raises throughput, backs off one
+// slot when a probe gains nothing, and halves on congestion (429/5xx,
+// dropped connections) or a throughput collapse.
+// Not thread safe: RequestHandler only touches it while holding mtx_.
+class ConcurrencyController {
+public:
+	struct Decision {
+		double ts = 0.0;
+		int limit = 0;
+		double bps = 0.0;           // aggregate throughput over the epoch
+		double per_transfer = 0.0;  // bps / average active transfers
+		std::string reason;
+	};
+
+	ConcurrencyController(int min_limit, int max_limit);
+
+	void set_max(int max_limit);
+	int limit() const noexcept { return limit_; }
+	int max_limit() const noexcept { return max_; }
+
+	// parallel connections one file may use: the budget left per transfer
+	int segments_per_file() const noexcept;
+
+	// bytes moved by all transfers during the last dt seconds; returns true
+	// when the limit changed
+	bool sample(double now, long long bytes, double dt, int active);
+	void on_congestion() noexcept { ++congestion_; }
+
+	double throughput_bps() const noexcept { return last_bps_; }
+	const std::deque<Decision>& decisions() const noexcept { return decisions_; }
+
+private:
+	void decide(double now, double bps, double avg_active);
+	void record(double now, double bps, double avg_active, const char* reason);
+
+	int min_;
+	int max_;
+	int limit_;
+
+	// current epoch
+	double epoch_start_ = 0.0;
+	double epoch_dt_ = 0.0;
+	long long epoch_bytes_ = 0;
+	double epoch_active_ = 0.0;   // active transfers integrated over time
+
+	double prev_bps_ = 0.0;       // previous epoch, for the gain check
+	double last_bps_ = 0.0;
+	bool probing_ = false;        // last epoch raised the limit
+	int hold_ = 0;                // epochs to wait before probing again
+	int congestion_ = 0;
+
+	std::deque<Decision> decisions_;
+};
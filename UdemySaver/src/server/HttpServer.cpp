@@ -7,11 +7,15 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <optional>
 
 namespace beast = boost::beast;
 namespace http = beast::http;
 using     tcp = boost::asio::ip::tcp;
 
+// /queue/batch carries a curriculum page of signed urls; beast's default 1 MB cap stays for the rest
+static constexpr std::uint64_t kBatchBodyLimit = 32ull << 20;
+
 static std::string read_file(const std::string& path) {
 	std::ifstream f(path, std::ios::binary);
 	if (!f) return {};
@@ -54,18 +58,34 @@ public:
 
 	void run() {
 		auto self = shared_from_this();
-		http::async_read(socket_, buffer_, req_,
+		parser_.emplace();
+		http::async_read_header(socket_, buffer_, *parser_,
+								[self](beast::error_code ec, std::size_t) {
+									if (ec) {
+										return self->shutdown();
+									}
+									if (self->parser_->get().target() == "/queue/batch") {
+										self->parser_->body_limit(kBatchBodyLimit);
+									}
+									self->read_body();
+								});
+	}
+
+private:
+	void read_body() {
+		auto self = shared_from_this();
+		http::async_read(socket_, buffer_, *parser_,
 						 [self](beast::error_code ec, std::size_t) {
 							 if (ec) {
 								 self->shutdown();
 							 }
 							 else {
+								 self->req_ = self->parser_->release();
 								 self->handle();
 							 }
 						 });
 	}
 
-private:
 	void handle() {
 		using status = http::status;
 
@@ -131,7 +151,7 @@ private:
 				return write(std::move(res));
 			}
 
-			if (req_.method() == http::verb::post && req_.target() == "/queue/pause") {
+			if (req_.method() == http::verb::post && (req_.target() == "/queue/pause" || req_.target() == "/queue/job/pause")) {
 				auto [st, body] = handler_->handleQueuePause(req_.body());
 				http::response<http::string_body> res{ st, req_.version() };
 				res.set(http::field::server, "beast");
@@ -141,7 +161,7 @@ private:
 				return write(std::move(res));
 			}
 
-			if (req_.method() == http::verb::post && req_.target() == "/queue/resume") {
+			if (req_.method() == http::verb::post && (req_.target() == "/queue/resume" || req_.target() == "/queue/job/resume")) {
 				auto [st, body] = handler_->handleQueueResume(req_.body());
 				http::response<http::string_body> res{ st, req_.version() };
 				res.set(http::field::server, "beast");
@@ -151,6 +171,46 @@ private:
 				return write(std::move(res));
 			}
 
+			if (req_.method() == http::verb::post && (req_.target() == "/queue/cancel" || req_.target() == "/queue/job/cancel")) {
+				auto [st, body] = handler_->handleQueueCancel(req_.body());
+				http::response<http::string_body> res{ st, req_.version() };
+				res.set(http::field::server, "beast");
+				res.set(http::field::content_type, "application/json");
+				res.body() = std::move(body);
+				res.prepare_payload();
+				return write(std::move(res));
+			}
+
+			if (req_.method() == http::verb::post && req_.target() == "/course/download") {
+				auto [st, body] = handler_->handleCourseDownload(req_.body());
+				http::response<http::string_body> res{ st, req_.version() };
+				res.set(http::field::server, "beast");
+				res.set(http::field::content_type, "application/json");
+				res.body() = std::move(body);
+				res.prepare_payload();
+				return write(std::move(res));
+			}
+
+			if (req_.method() == http::verb::post && req_.target() == "/queue/batch") {
+				auto [st, body] = handler_->handleQueueBatch(req_.body());
+				http::response<http::string_body> res{ st, req_.version() };
+				res.set(http::field::server, "beast");
+				res.set(http::field::content_type, "application/json");
+				res.body() = std::move(body);
+				res.prepare_payload();
+				return write(std::move(res));
+			}
+
+			if (req_.method() == http::verb::post && req_.target() == "/queue/priority") {
+				auto [st, body] = handler_->handleQueuePriority(req_.body());
+				http::response<http::string_body> res{ st, req_.version() };
+				res.set(http::field::server, "beast");
+				res.set(http::field::content_type, "application/json");
+				res.body() = std::move(body);
+				res.prepare_payload();
+				return write(std::move(res));
+			}
+
 			// GET /api/lectures?courseId=&page=&page_size=
 			if (req_.method() == http::verb::get &&
 				(std::string(req_.target()).rfind("/lectures", 0) == 0 ||
@@ -240,6 +300,42 @@ private:
 				return write(std::move(res));
 			}
 
+			// GET /verify?course_id=&deep=&threads= (starts a check), GET /verify?id= (polls it)
+			if (req_.method() == http::verb::get &&
+				std::string(req_.target()).rfind("/verify", 0) == 0) {
+
+				auto [st, body] = handler_->handleVerify(std::string(req_.target()));
+				http::response<http::string_body> res{ st, req_.version() };
+				res.set(http::field::server, "beast");
+				res.set(http::field::content_type, "application/json");
+				res.body() = std::move(body);
+				res.prepare_payload();
+				return write(std::move(res));
+			}
+
+			if (req_.method() == http::verb::get && req_.target() == "/metrics") {
+				auto [st, body] = handler_->handleMetrics();
+				http::response<http::string_body> res{ st, req_.version() };
+				res.set(http::field::server, "beast");
+				res.set(http::field::content_type, "application/json");
+				res.body() = std::move(body);
+				res.prepare_payload();
+				return write(std::move(res));
+			}
+
+			// GET /history?course_id=&page=
+			if (req_.method() == http::verb::get &&
+				std::string(req_.target()).rfind("/history", 0) == 0) {
+
+				auto [st, body] = handler_->handleHistory(std::string(req_.target()));
+				http::response<http::string_body> res{ st, req_.version() };
+				res.set(http::field::server, "beast");
+				res.set(http::field::content_type, "application/json");
+				res.body() = std::move(body);
+				res.prepare_payload();
+				return write(std::move(res));
+			}
+
 			// Statik dosya: /www/...
 			if (req_.method() == http::verb::get &&
 				std::string(req_.target()).rfind("/www/", 0) == 0) {
@@ -292,6 +388,7 @@ private:
 
 	tcp::socket socket_;
 	beast::flat_buffer buffer_;
+	std::optional<http::request_parser<http::string_body>> parser_;  // header first, so the body limit can follow the target
 	http::request<http::string_body> req_;
 	std::shared_ptr<RequestHandler> handler_;
 };
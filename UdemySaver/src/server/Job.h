@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "RetryPolicy.h"
+#include "TransferContext.h"
+
+// Live counters of one running transfer. Written by the transfer thread
+// without locking, read by handleQueueList; own cache line so concurrent
+// transfers do not false-share.
+struct alignas(64) ProgressSlot {
+	std::atomic<long long> bytes_now{ 0 };
+	std::atomic<long long> bytes_total{ 0 };
+	std::atomic<int> control{ 0 };  // TransferControl, set by pause/cancel requests
+
+	// HLS: media time remuxed so far and playlist duration, milliseconds
+	std::atomic<long long> media_ms_now{ 0 };
+	std::atomic<long long> media_ms_total{ 0 };
+
+	// HLS: stage timings of the running transfer so far, microseconds; the
+	// finished totals go to Job::stages
+	std::atomic<long long> open_us{ 0 };
+	std::atomic<long long> probe_us{ 0 };
+	std::atomic<long long> read_us{ 0 };
+	std::atomic<long long> write_us{ 0 };
+	std::atomic<long long> output_wait_us{ 0 };
+	std::atomic<long long> finish_us{ 0 };
+	std::atomic<long long> total_us{ 0 };
+	std::atomic<long long> packets{ 0 };
+	std::atomic<long long> stage_bytes{ 0 };
+	std::atomic<long long> fast_probes{ 0 };
+
+	void store_stages(const HlsStages& s) {
+		auto us = [](double ms) { return static_cast<long long>(ms * 1000.0); };
+		open_us.store(us(s.open_ms), std::memory_order_relaxed);
+		probe_us.store(us(s.probe_ms), std::memory_order_relaxed);
+		read_us.store(us(s.read_ms), std::memory_order_relaxed);
+		write_us.store(us(s.write_ms), std::memory_order_relaxed);
+		output_wait_us.store(us(s.output_wait_ms), std::memory_order_relaxed);
+		finish_us.store(us(s.finish_ms), std::memory_order_relaxed);
+		packets.store(s.packets, std::memory_order_relaxed);
+		stage_bytes.store(s.bytes, std::memory_order_relaxed);
+		fast_probes.store(s.fast_probes, std::memory_order_relaxed);
+		total_us.store(us(s.total_ms), std::memory_order_relaxed);
+	}
+
+	// fields may come from two consecutive publishes; fine for a status view
+	HlsStages load_stages() const {
+		auto ms = [](const std::atomic<long long>& v) { return v.load(std::memory_order_relaxed) / 1000.0; };
+		HlsStages s;
+		s.open_ms = ms(open_us);
+		s.probe_ms = ms(probe_us);
+		s.read_ms = ms(read_us);
+		s.write_ms = ms(write_us);
+		s.output_wait_ms = ms(output_wait_us);
+		s.finish_ms = ms(finish_us);
+		s.total_ms = ms(total_us);
+		s.packets = packets.load(std::memory_order_relaxed);
+		s.bytes = stage_bytes.load(std::memory_order_relaxed);
+		s.fast_probes = fast_probes.load(std::memory_order_relaxed);
+		return s;
+	}
+};
+
+struct Job {
+	uint64_t id = 0;
+	std::string url;
+	std::string filename;
+	std::vector<std::string> headers;
+
+	int  course_id = 0;
+	std::string course_title;
+	std::string out_path_dir;
+	std::string out_path;
+
+	int section_index = 0;
+	std::string section_title;
+	int lecture_index = 0;
+	std::string lecture_title;
+
+	// source identity, so an expiring signed url can be re-resolved at dispatch
+	int lecture_id = 0;
+	int asset_id = 0;         // supplementary asset
+	std::string quality;      // lecture video
+	std::string container;    // HLS output (ts|mp4|fmp4), empty = settings
+	std::vector<std::pair<std::string, std::string>> captions;  // (language, url) to embed, mp4/fmp4 only
+	double url_ts = 0.0;      // when url was signed (steady clock), 0 = unknown
+	int url_refreshes = 0;    // re-signed after the CDN rejected the url mid-transfer
+	int reconnects = 0;       // transfers torn down as stalled/slow and resumed
+	long long net_bytes = 0;  // received on the wire over all attempts
+	HlsStages stages;         // timings of the last HLS transfer, running totals while Downloading
+
+	// automatic retries after a failed transfer (see RetryPolicy)
+	int attempts = 0;         // all classes
+	std::array<int, RetryPolicy::kClasses> class_attempts{};  // by RetryPolicy::Class, each against its own budget
+	double retry_at = 0.0;    // steady clock, while Retrying
+	std::string error_class;  // class of the last failure
+
+	enum class State { Queued, Downloading, Done, Failed, Paused, Retrying, Cancelled };
+	State state = State::Queued;
+	bool finished() const { return state == State::Done || state == State::Failed || state == State::Cancelled; }
+	int priority = 0; // used by the "priority" scheduling policy
+
+	double progress = 0.0;
+	std::string message;
+
+	long long bytes_now = 0;
+	long long bytes_total = 0;
+	double    speed_bps = 0.0;
+	double    media_now = 0.0;      // HLS, seconds of the stream remuxed
+	double    media_total = 0.0;    // HLS, sum of EXTINF, 0 = not an HLS job / unknown
+	double    media_rate = 0.0;     // media seconds per second, EWMA
+
+	std::shared_ptr<ProgressSlot> slot; // set while Downloading
+	long long sample_bytes = 0;         // reader-side EWMA state
+	double    sample_ts = 0.0;
+	double    sample_media = 0.0;
+};
@@ -0,0 +1,86 @@
+#include "JobScheduler.h"
+
+#include <climits>
+#include <tuple>
+
+bool JobScheduler::Order::operator()(const Key& a, const Key& b) const {
+	// every policy ends on id, so keys are unique and ties stay FIFO
+	switch (*policy)
+	{
+	case Policy::Course:
+		return std::tie(a.course_id, a.section_index, a.lecture_index, a.id) <
+			std::tie(b.course_id, b.section_index, b.lecture_index, b.id);
+	case Policy::Smallest:
+	{
+		long long sa = a.size < 0 ? LLONG_MAX : a.size;
+		long long sb = b.size < 0 ? LLONG_MAX : b.size;
+		return std::tie(sa, a.id) < std::tie(sb, b.id);
+	}
+	case Policy::Priority:
+		return std::make_tuple(-a.priority, a.id) < std::make_tuple(-b.priority, b.id);
+	case Policy::Fifo:
+	default:
+		return a.id < b.id;
+	}
+}
+
+JobScheduler::JobScheduler(Policy p)
+	: policy_(p), ready_(Order{ &policy_ }) {
+}
+
+void JobScheduler::set_policy(Policy p) {
+	if (p == policy_) return;
+	policy_ = p;
+
+	std::set<Key, Order> resorted(Order{ &policy_ });
+	for (auto& [id, k] : keys_) resorted.insert(k);
+	ready_.swap(resorted);
+}
+
+void JobScheduler::push(const Key& k) {
+	if (!k.id) return;
+	remove(k.id);
+	ready_.insert(k);
+	keys_[k.id] = k;
+}
+
+bool JobScheduler::remove(uint64_t id) {
+	auto it = keys_.find(id);
+	if (it == keys_.end()) return false;
+	ready_.erase(it->second);
+	keys_.erase(it);
+	return true;
+}
+
+uint64_t JobScheduler::pop() {
+	if (ready_.empty()) return 0;
+	auto it = ready_.begin();
+	uint64_t id = it->id;
+	ready_.erase(it);
+	keys_.erase(id);
+	return id;
+}
+
+std::vector<uint64_t> JobScheduler::peek(size_t n) const {
+	std::vector<uint64_t> ids;
+	for (auto it = ready_.begin(); it != ready_.end() && ids.size() < n; ++it) ids.push_back(it->id);
+	return ids;
+}
+
+JobScheduler::Policy JobScheduler::policy_from_name(const std::string& s) {
+	if (s == "course")   return Policy::Course;
+	if (s == "smallest") return Policy::Smallest;
+	if (s == "priority") return Policy::Priority;
+	return Policy::Fifo;
+}
+
+const char* JobScheduler::policy_name(Policy p) {
+	switch (p)
+	{
+	case Policy::Course:   return "course";
+	case Policy::Smallest: return "smallest";
+	case Policy::Priority: return "priority";
+	case Policy::Fifo:     return "fifo";
+	}
+	return "fifo";
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Ready set of queued jobs, ordered by the active policy.
+// Only Queued jobs live here; paused/running/finished jobs are removed, so
+// picking the next job never walks the rest of the queue.
+// Not thread safe: RequestHandler only touches it while holding mtx_.
+class JobScheduler {
+public:
+	enum class Policy { Fifo, Course, Smallest, Priority };
+
+	struct Key {
+		uint64_t id = 0;
+		int course_id = 0;
+		int section_index = 0;
+		int lecture_index = 0;
+		long long size = -1;   // bytes, -1 when unknown
+		int priority = 0;      // higher runs first
+	};
+
+	explicit JobScheduler(Policy p = Policy::Fifo);
+	JobScheduler(const JobScheduler&) = delete;
+	JobScheduler& operator=(const JobScheduler&) = delete;
+
+	void set_policy(Policy p);
+	Policy policy() const noexcept { return policy_; }
+
+	void push(const Key& k);          // insert or re-key
+	bool remove(uint64_t id);
+	uint64_t pop();                   // best ready id, 0 if none
+	std::vector<uint64_t> peek(size_t n) const;  // next n ids in pop order
+	bool contains(uint64_t id) const { return keys_.count(id) != 0; }
+	bool empty() const noexcept { return ready_.empty(); }
+	size_t size() const noexcept { return ready_.size(); }
+
+	static Policy policy_from_name(const std::string& s);
+	static const char* policy_name(Policy p);
+
+private:
+	struct Order {
+		const Policy* policy;
+		bool operator()(const Key& a, const Key& b) const;
+	};
+
+	Policy policy_;
+	std::set<Key, Order> ready_;
+	std::unordered_map<uint64_t, Key> keys_;
+};
@@ -0,0 +1,94 @@
+#include "JobStore.h"
+
+namespace {
+	bool is_live(const Job& j) {
+		return !j.finished();
+	}
+}
+
+std::string JobStore::normalize_url(const std::string& url) {
+	// CDN links carry an expiring signature in the query; the path is the identity
+	auto cut = url.find_first_of("?#");
+	return cut == std::string::npos ? url : url.substr(0, cut);
+}
+
+std::string JobStore::path_key(const std::string& out_dir, const std::string& filename) {
+	return out_dir + "/" + filename;
+}
+
+Job& JobStore::insert(Job j) {
+	jobs_.push_back(std::move(j));
+	auto it = std::prev(jobs_.end());
+	by_id_[it->id] = it;
+
+	Keys& k = keys_[it->id];
+	k.url = normalize_url(it->url);
+	k.path = path_key(it->out_path_dir, it->filename);
+
+	if (it->course_id) by_course_[it->course_id].insert(it->id);
+	if (is_live(*it)) mark_active(*it);
+	return *it;
+}
+
+void JobStore::erase(uint64_t id) {
+	auto it = by_id_.find(id);
+	if (it == by_id_.end()) return;
+
+	mark_finished(*it->second);
+	int course_id = it->second->course_id;
+	if (course_id)
+	{
+		auto c = by_course_.find(course_id);
+		if (c != by_course_.end())
+		{
+			c->second.erase(id);
+			if (c->second.empty()) by_course_.erase(c);
+		}
+	}
+
+	jobs_.erase(it->second);
+	keys_.erase(id);
+	by_id_.erase(it);
+}
+
+Job* JobStore::find(uint64_t id) {
+	auto it = by_id_.find(id);
+	return it == by_id_.end() ? nullptr : &*it->second;
+}
+
+Job* JobStore::find_active_duplicate(const std::string& url, const std::string& out_dir, const std::string& filename) {
+	auto u = by_url_.find(normalize_url(url));
+	if (u != by_url_.end()) return find(u->second);
+
+	auto p = by_path_.find(path_key(out_dir, filename));
+	if (p != by_path_.end()) return find(p->second);
+
+	return nullptr;
+}
+
+void JobStore::mark_finished(const Job& j) {
+	auto k = keys_.find(j.id);
+	if (k == keys_.end() || !k->second.active) return;
+
+	auto u = by_url_.find(k->second.url);
+	if (u != by_url_.end() && u->second == j.id) by_url_.erase(u);
+	auto p = by_path_.find(k->second.path);
+	if (p != by_path_.end() && p->second == j.id) by_path_.erase(p);
+	k->second.active = false;
+}
+
+void JobStore::mark_active(const Job& j) {
+	auto k = keys_.find(j.id);
+	if (k == keys_.end() || k->second.active) return;
+
+	// first live job keeps the slot; a later one only ever exists via recovery
+	if (!k->second.url.empty()) by_url_.emplace(k->second.url, j.id);
+	by_path_.emplace(k->second.path, j.id);
+	k->second.active = true;
+}
+
+const std::unordered_set<uint64_t>& JobStore::course_jobs(int course_id) const {
+	static const std::unordered_set<uint64_t> none;
+	auto it = by_course_.find(course_id);
+	return it == by_course_.end() ? none : it->second;
+}
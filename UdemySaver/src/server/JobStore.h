@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Job.h"
+
+// Job storage with hash indexes. Jobs are kept in insertion order in a
+// list (stable references); lookups by id, by normalized URL, by output
+// path and by course are O(1). The URL and path indexes only hold active
+// jobs (not Done/Failed/Cancelled), which is exactly the duplicate rule of /queue.
+// Not thread safe: RequestHandler only touches it while holding mtx_.
+class JobStore {
+public:
+	using iterator = std::list<Job>::iterator;
+
+	Job& insert(Job j);
+	void erase(uint64_t id);
+
+	Job* find(uint64_t id);
+	// active job with the same URL (signature stripped) or the same target file
+	Job* find_active_duplicate(const std::string& url, const std::string& out_dir, const std::string& filename);
+
+	// keep the dedupe indexes in sync with finished <-> live transitions
+	void mark_finished(const Job& j);
+	void mark_active(const Job& j);
+
+	// ids of a course's jobs, empty set if none
+	const std::unordered_set<uint64_t>& course_jobs(int course_id) const;
+
+	iterator begin() { return jobs_.begin(); }
+	iterator end() { return jobs_.end(); }
+	size_t size() const noexcept { return jobs_.size(); }
+	bool empty() const noexcept { return jobs_.empty(); }
+
+	static std::string normalize_url(const std::string& url);
+	static std::string path_key(const std::string& out_dir, const std::string& filename);
+
+private:
+	struct Keys {
+		std::string url;
+		std::string path;
+		bool active = false;
+	};
+
+	std::list<Job> jobs_;
+	std::unordered_map<uint64_t, iterator> by_id_;
+	std::unordered_map<uint64_t, Keys> keys_;  // index keys captured at insert
+	std::unordered_map<std::string, uint64_t> by_url_;
+	std::unordered_map<std::string, uint64_t> by_path_;
+	std::unordered_map<int, std::unordered_set<uint64_t>> by_course_;
+};
@@ -0,0 +1,154 @@
+#include "QueueJournal.h"
+
+#include "Helper.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+	void sync_file(FILE* fp) {
+		fflush(fp);
+#ifdef _WIN32
+		_commit(_fileno(fp));
+#else
+		fsync(fileno(fp));
+#endif
+	}
+}
+
+QueueJournal::QueueJournal(std::string path) : path_(std::move(path)) {}
+
+QueueJournal::~QueueJournal() {
+	if (fp_) fclose(fp_);
+}
+
+void QueueJournal::replay(const std::function<void(const nlohmann::json&)>& fn) {
+	std::string text = Helper::read_file_utf8(path_);
+
+	// Parsing dominates recovery time, so large journals are split at line
+	// boundaries and parsed in parallel; records are still applied in order.
+	unsigned parts = 1;
+	if (text.size() > (4u << 20))
+		parts = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+
+	std::vector<size_t> cuts{ 0 };
+	for (unsigned i = 1; i < parts; ++i)
+	{
+		size_t nl = text.find('\n', text.size() * i / parts);
+		if (nl == std::string::npos) break;
+		if (nl + 1 > cuts.back()) cuts.push_back(nl + 1);
+	}
+	cuts.push_back(text.size());
+
+	std::vector<std::vector<nlohmann::json>> parsed(cuts.size() - 1);
+	auto parse_range = [&](size_t idx)
+		{
+			size_t pos = cuts[idx], stop = cuts[idx + 1];
+			while (pos < stop)
+			{
+				size_t nl = text.find('\n', pos);
+				size_t end = (nl == std::string::npos || nl > stop) ? stop : nl;
+				if (end > pos)
+				{
+					auto rec = nlohmann::json::parse(text.data() + pos, text.data() + end, nullptr, false);
+					if (!rec.is_discarded() && rec.is_object()) parsed[idx].push_back(std::move(rec));
+				}
+				pos = end + 1;
+			}
+		};
+
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < parsed.size(); ++i) pool.emplace_back(parse_range, i);
+	parse_range(0);
+	for (auto& t : pool) t.join();
+
+	records_ = 0;
+	for (auto& chunk : parsed)
+	{
+		for (auto& rec : chunk) fn(rec);
+		records_ += chunk.size();
+		chunk.clear();
+	}
+
+	open_for_append();
+
+	// a torn tail must not swallow the next record
+	if (fp_ && !text.empty() && text.back() != '\n')
+	{
+		fputc('\n', fp_);
+		fflush(fp_);
+	}
+}
+
+bool QueueJournal::open_for_append() {
+	if (fp_) return true;
+	fp_ = Helper::xfopen(path_.c_str(), "ab");
+	return fp_ != nullptr;
+}
+
+void QueueJournal::append(const nlohmann::json& rec) {
+	if (!open_for_append()) return;
+
+	std::string line = rec.dump();
+	line.push_back('\n');
+	fwrite(line.data(), 1, line.size(), fp_);
+	fflush(fp_);
+	++records_;
+}
+
+void QueueJournal::append(const std::vector<nlohmann::json>& recs) {
+	if (recs.empty() || !open_for_append()) return;
+
+	std::string buf;
+	for (auto& rec : recs)
+	{
+		buf += rec.dump();
+		buf.push_back('\n');
+	}
+	fwrite(buf.data(), 1, buf.size(), fp_);
+	fflush(fp_);
+	records_ += recs.size();
+}
+
+bool QueueJournal::compact(const std::vector<nlohmann::json>& snapshot) {
+	std::string tmp = path_ + ".tmp";
+	FILE* out = Helper::xfopen(tmp.c_str(), "wb");
+	if (!out) return false;
+
+	std::string buf;
+	for (auto& rec : snapshot)
+	{
+		buf += rec.dump();
+		buf.push_back('\n');
+		if (buf.size() >= (1u << 20))
+		{
+			fwrite(buf.data(), 1, buf.size(), out);
+			buf.clear();
+		}
+	}
+	if (!buf.empty()) fwrite(buf.data(), 1, buf.size(), out);
+	sync_file(out);
+	fclose(out);
+
+	if (fp_)
+	{
+		fclose(fp_);
+		fp_ = nullptr;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(std::filesystem::u8path(tmp), std::filesystem::u8path(path_), ec);
+	open_for_append();
+	if (ec) return false;
+
+	records_ = snapshot.size();
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Append-only log of queue lifecycle events, one json object per line.
+// Not thread safe: RequestHandler only touches it while holding mtx_.
+class QueueJournal {
+public:
+	explicit QueueJournal(std::string path);
+	~QueueJournal();
+
+	QueueJournal(const QueueJournal&) = delete;
+	QueueJournal& operator=(const QueueJournal&) = delete;
+
+	// Feeds every record to fn in write order. A torn last line (crash
+	// mid-write) is skipped. Opens the journal for appending afterwards.
+	void replay(const std::function<void(const nlohmann::json&)>& fn);
+
+	void append(const nlohmann::json& rec);
+	// one write + flush for the whole batch
+	void append(const std::vector<nlohmann::json>& recs);
+
+	// Replaces the whole journal with `snapshot` (tmp file + rename).
+	bool compact(const std::vector<nlohmann::json>& snapshot);
+
+	size_t records() const noexcept { return records_; }
+
+private:
+	bool open_for_append();
+
+	std::string path_;
+	FILE* fp_ = nullptr;
+	size_t records_ = 0;
+};
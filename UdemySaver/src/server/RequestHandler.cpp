@@ -22,6 +22,10 @@
 #include <cstdio>
 #include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <memory>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -33,17 +37,176 @@ extern "C" {
 }
 
 // utils/helper
+#include "Checksum.h"
 #include "FFmpegHelper.h"
 #include "Helper.h"
+#include "TransferContext.h"
 
 using boost::beast::http::status;
 using json = nlohmann::json;
 
 namespace {
 	constexpr const char* kDefaultUserAgent = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/134.0.0.0 Safari/537.36 Edg/134.0.0.0";
+	constexpr const char* kManifestName = ".checksums.jsonl"; // per-course, one json object per line
+	constexpr const char* kHistoryDir = "history";            // history/<course_id>.jsonl
+	constexpr size_t kHistoryRing = 256;                      // finished jobs kept in memory
+	constexpr size_t kHistoryPageSize = 50;
+	constexpr double kUrlFreshSec = 15 * 60;                  // re-sign older urls before use
+	constexpr double kPrefetchMarginSec = 5 * 60;             // resolver refreshes this much earlier
+	constexpr size_t kPrefetchAhead = 4;                      // ready jobs kept pre-signed
+	constexpr int kMaxUrlRefreshes = 3;                       // per transfer, on 401/403/410
+	constexpr int kMaxReconnects = 8;                         // per transfer, after stalls
+	constexpr long long kSmallFileBytes = 8ll << 20;          // fast lane upper bound
+	constexpr int kSmallLaneWorkers = 8;
+	constexpr size_t kVerifyRunsKept = 16;                    // finished /verify results kept for polling
+
+	const char* state_name(RequestHandler::Job::State s) {
+		using S = RequestHandler::Job::State;
+		switch (s)
+		{
+		case S::Queued:       return "queued";
+		case S::Downloading:  return "downloading";
+		case S::Done:         return "done";
+		case S::Failed:       return "failed";
+		case S::Paused:       return "paused";
+		case S::Retrying:     return "retrying";
+		case S::Cancelled:    return "cancelled";
+		}
+		return "unknown";
+	}
+
+	RequestHandler::Job::State state_from_name(const std::string& s) {
+		using S = RequestHandler::Job::State;
+		if (s == "downloading") return S::Downloading;
+		if (s == "done")        return S::Done;
+		if (s == "failed")      return S::Failed;
+		if (s == "paused")      return S::Paused;
+		if (s == "retrying")    return S::Retrying;
+		if (s == "cancelled")   return S::Cancelled;
+		return S::Queued;
+	}
+
+	inline double now_sec() {
+		using namespace std::chrono;
+		return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	// journaled as an array indexed by RetryPolicy::Class
+	void read_class_attempts(const json& o, RequestHandler::Job& j) {
+		if (!o.contains("class_attempts") || !o["class_attempts"].is_array()) return;
+		const auto& a = o["class_attempts"];
+		for (size_t i = 0; i < a.size() && i < j.class_attempts.size(); ++i)
+			j.class_attempts[i] = a[i].is_number_integer() ? a[i].get<int>() : 0;
+	}
+
+	json stages_to_json(const HlsStages& s) {
+		return { {"open_ms", s.open_ms}, {"probe_ms", s.probe_ms}, {"read_ms", s.read_ms},
+				 {"write_ms", s.write_ms}, {"output_wait_ms", s.output_wait_ms}, {"finish_ms", s.finish_ms},
+				 {"total_ms", s.total_ms}, {"packets", s.packets}, {"bytes", s.bytes}, {"fast_probes", s.fast_probes} };
+	}
+
+	// lecture numbers that already have a video in `dir`: "NNN - <anything>.mp4|.ts",
+	// whatever title or quality label the name carries after the number.
+	// Attachments are "NNN - <title> - <name>" and do not count.
+	std::unordered_set<int> lectures_on_disk(const std::filesystem::path& dir) {
+		std::unordered_set<int> out;
+		std::error_code ec;
+		for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (!it->is_regular_file(ec)) continue;
+			const std::string ext = it->path().extension().string();
+			if (ext != ".mp4" && ext != ".ts") continue;
+			const auto u8 = it->path().filename().u8string();
+			const std::string name(u8.begin(), u8.end());
+			size_t digits = 0;
+			while (digits < name.size() && digits < 6 && std::isdigit(static_cast<unsigned char>(name[digits]))) ++digits;
+			if (digits < 3 || name.compare(digits, 3, " - ") != 0) continue;
+			if (name.find(" - ", digits + 3) != std::string::npos) continue;
+			out.insert(std::stoi(name.substr(0, digits)));
+		}
+		return out;
+	}
+
+	// enough ids to ask the API for a freshly signed url
+	bool can_resolve(const RequestHandler::Job& j) {
+		return j.course_id && j.lecture_id && (j.asset_id || !j.quality.empty());
+	}
+
+	// no url yet, no signing time, or signed too long ago (minus `margin` seconds)
+	bool url_is_stale(const RequestHandler::Job& j, double now, double margin = 0.0) {
+		if (!can_resolve(j)) return false;
+		return j.url.empty() || j.url_ts <= 0.0 || now - j.url_ts > kUrlFreshSec - margin;
+	}
+
+	// transport failures worth retrying; write errors and bad options are not
+	bool is_network_error(CURLcode rc) {
+		switch (rc)
+		{
+		case CURLE_COULDNT_RESOLVE_PROXY:
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_SSL_CONNECT_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_HTTP2:
+		case CURLE_HTTP2_STREAM:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// captions and documents go to the fast lane; sizes win over the extension when known
+	bool is_small_job(const RequestHandler::Job& j) {
+		if (j.bytes_total > 0) return j.bytes_total <= kSmallFileBytes;
+		if (!j.quality.empty()) return false;  // lecture video
+
+		auto dot = j.filename.rfind('.');
+		if (dot == std::string::npos) return false;
+		std::string ext = j.filename.substr(dot + 1);
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		static const std::unordered_set<std::string> small{ "vtt", "srt", "txt", "pdf", "html", "htm", "md", "json", "xml", "csv" };
+		return small.count(ext) != 0;
+	}
+
+	// headers every job gets; they are rebuilt on recovery instead of being journaled
+	bool is_default_header(const std::string& h) {
+		auto starts = [&](const char* p) { return h.rfind(p, 0) == 0; };
+		return starts("User-Agent:") || starts("Referer:") || starts("Origin:") || starts("Authorization:");
+	}
 }
 
-struct CurlHandle { CURL* h = nullptr; CurlHandle() { h = curl_easy_init(); } ~CurlHandle() { if (h) curl_easy_cleanup(h); } };
+struct CurlHandle { CURL* h = nullptr; explicit CurlHandle(bool init = true) { if (init) h = curl_easy_init(); } ~CurlHandle() { if (h) curl_easy_cleanup(h); } };
+
+// DNS and TLS sessions shared by the fast lane, so a worker that has to
+// open a new connection resumes the TLS session instead of a full handshake.
+// Connections themselves are not shared (libcurl does not allow that across
+// threads); each fast-lane worker keeps its own handle and connection.
+struct CurlShare {
+	CURLSH* sh = nullptr;
+	std::mutex locks[CURL_LOCK_DATA_LAST];
+
+	CurlShare() {
+		sh = curl_share_init();
+		if (!sh) return;
+		curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, lock_cb);
+		curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, unlock_cb);
+		curl_share_setopt(sh, CURLSHOPT_USERDATA, this);
+		curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
+	~CurlShare() { if (sh) curl_share_cleanup(sh); }
+
+	static void lock_cb(CURL*, curl_lock_data data, curl_lock_access, void* user) {
+		static_cast<CurlShare*>(user)->locks[data].lock();
+	}
+	static void unlock_cb(CURL*, curl_lock_data data, void* user) {
+		static_cast<CurlShare*>(user)->locks[data].unlock();
+	}
+};
 
 size_t RequestHandler::header_probe_cb(char* buffer, size_t size, size_t nitems, void* userdata) {
 	size_t total = size * nitems;
@@ -288,7 +451,7 @@ std::string RequestHandler::pick_from_asset_for_size(const json& a, const std::s
 	if (!hls_candidate.empty())
 		return hls_candidate;
 
-	return hls_by_quality.rbegin()->second;
+	return hls_by_quality.empty() ? std::string{} : hls_by_quality.rbegin()->second;
 }
 
 // ---------------- ctor / dtor ----------------
@@ -297,8 +460,16 @@ RequestHandler::RequestHandler(std::string webroot)
 	curl_global_init(CURL_GLOBAL_DEFAULT);
 	avformat_network_init();
 	load_settings();
-
-	worker_ = std::thread([this] { worker_loop(); });
+	share_ = std::make_unique<CurlShare>();
+	recover_queue();
+
+	workers_.emplace_back([this] { worker_loop(); });
+	for (int i = 0; i < kSmallLaneWorkers; ++i)
+		small_workers_.emplace_back([this] { worker_loop(true); });
+	monitor_ = std::thread([this] { monitor_loop(); });
+	feeder_ = std::thread([this] { feeder_loop(); });
+	resolver_ = std::thread([this] { resolver_loop(); });
+	verifier_ = std::thread([this] { verifier_loop(); });
 }
 
 RequestHandler::~RequestHandler() {
@@ -307,7 +478,18 @@ RequestHandler::~RequestHandler() {
 		stop_ = true;
 	}
 	cv_.notify_all();
-	if (worker_.joinable()) worker_.join();
+	feed_cv_.notify_all();
+	resolve_cv_.notify_all();
+	verify_cv_.notify_all();
+	monitor_cv_.notify_all();
+	if (monitor_.joinable()) monitor_.join();
+	for (auto& w : workers_) if (w.joinable()) w.join();
+	for (auto& w : small_workers_) if (w.joinable()) w.join();
+	if (feeder_.joinable()) feeder_.join();
+	if (resolver_.joinable()) resolver_.join();
+	if (verifier_.joinable()) verifier_.join();
+
+	share_.reset();
 
 	curl_global_cleanup();
 	avformat_network_deinit();
@@ -329,6 +511,11 @@ void RequestHandler::load_settings() {
 			f << "# http_proxy=\n";
 			f << "download_subtitles=true\n";
 			f << "download_assets=true\n";
+			f << "checksum_sha256=false\n";
+			f << "queue_policy=fifo\n";
+			f << "max_parallel=4\n";
+			f << "hls_container=ts\n";
+			f << "embed_captions=false\n";
 		}
 
 		token_.clear();
@@ -336,6 +523,7 @@ void RequestHandler::load_settings() {
 		proxy_.clear();
 		download_subtitles_ = true;
 		download_assets_ = true;
+		checksum_sha256_ = false;
 		return;
 	}
 
@@ -382,6 +570,41 @@ void RequestHandler::load_settings() {
 		std::transform(v.begin(), v.end(), v.begin(), ::tolower);
 		download_assets_ = (v == "1" || v == "true" || v == "yes" || v == "on");
 	}
+
+	if (kv.count("checksum_sha256"))
+	{
+		std::string v = kv["checksum_sha256"];
+		std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+		checksum_sha256_ = (v == "1" || v == "true" || v == "yes" || v == "on");
+	}
+
+	if (kv.count("queue_policy"))
+	{
+		std::string v = kv["queue_policy"];
+		std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+		scheduler_.set_policy(JobScheduler::policy_from_name(v));
+	}
+
+	if (kv.count("max_parallel"))
+	{
+		try { max_parallel_ = std::clamp(std::stoi(kv["max_parallel"]), 1, 16); }
+		catch (...) {}
+	}
+	controller_.set_max(max_parallel_);
+
+	if (kv.count("hls_container"))
+	{
+		std::string v = kv["hls_container"];
+		std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+		hls_container_ = FFmpegHelper::container_name(v);
+	}
+
+	if (kv.count("embed_captions"))
+	{
+		std::string v = kv["embed_captions"];
+		std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+		embed_captions_ = (v == "1" || v == "true" || v == "yes" || v == "on");
+	}
 }
 
 // ---------------- Udemy GET ----------------
@@ -482,12 +705,22 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleSetting
 		std::string new_proxy = proxy_;
 		bool new_subs = download_subtitles_;
 		bool new_assets = download_assets_;
+		bool new_sha256 = checksum_sha256_;
+		std::string new_policy = JobScheduler::policy_name(scheduler_.policy());
+		int new_parallel = max_parallel_;
+		std::string new_container = hls_container_;
+		bool new_embed = embed_captions_;
 
 		if (in.contains("udemy_access_token")) new_token = in.value("udemy_access_token", std::string{});
 		if (in.contains("udemy_api_base"))    new_api = in.value("udemy_api_base", std::string{});
 		if (in.contains("http_proxy"))        new_proxy = in.value("http_proxy", std::string{});
 		if (in.contains("download_subtitles")) new_subs = in.value("download_subtitles", false);
 		if (in.contains("download_assets"))    new_assets = in.value("download_assets", false);
+		if (in.contains("checksum_sha256"))    new_sha256 = in.value("checksum_sha256", false);
+		if (in.contains("queue_policy"))       new_policy = in.value("queue_policy", std::string{ "fifo" });
+		if (in.contains("max_parallel"))       new_parallel = std::clamp(in.value("max_parallel", 4), 1, 16);
+		if (in.contains("hls_container"))      new_container = FFmpegHelper::container_name(in.value("hls_container", std::string{ "ts" }));
+		if (in.contains("embed_captions"))     new_embed = in.value("embed_captions", false);
 
 		auto trim2 = [](std::string s)
 			{
@@ -499,6 +732,7 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleSetting
 		new_token = trim2(new_token);
 		new_api = trim2(new_api);
 		new_proxy = trim2(new_proxy);
+		new_policy = JobScheduler::policy_name(JobScheduler::policy_from_name(trim2(new_policy)));
 		if (new_api.empty()) new_api = "https://www.udemy.com";
 
 		{
@@ -514,6 +748,11 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleSetting
 			if (!new_proxy.empty()) f << "http_proxy=" << new_proxy << "\n";
 			f << "download_subtitles=" << (new_subs ? "true" : "false") << "\n";
 			f << "download_assets=" << (new_assets ? "true" : "false") << "\n";
+			f << "checksum_sha256=" << (new_sha256 ? "true" : "false") << "\n";
+			f << "queue_policy=" << new_policy << "\n";
+			f << "max_parallel=" << new_parallel << "\n";
+			f << "hls_container=" << new_container << "\n";
+			f << "embed_captions=" << (new_embed ? "true" : "false") << "\n";
 			f.flush();
 		}
 
@@ -522,6 +761,15 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleSetting
 		proxy_ = new_proxy;
 		download_subtitles_ = new_subs;
 		download_assets_ = new_assets;
+		checksum_sha256_ = new_sha256;
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			scheduler_.set_policy(JobScheduler::policy_from_name(new_policy));
+			max_parallel_ = new_parallel;
+			controller_.set_max(max_parallel_);
+			hls_container_ = new_container;
+			embed_captions_ = new_embed;
+		}
 
 		out["ok"] = true;
 		out["auth"] = !token_.empty();
@@ -703,18 +951,7 @@ RequestHandler::handleLectures(int course_id, int page, int page_size) {
 			return { status::ok, out.dump() };
 		}
 
-		// subscriber-curriculum-items => chapter + lecture + asset
-		std::ostringstream url;
-		url << api_base_
-			<< "/api-2.0/courses/" << course_id
-			<< "/subscriber-curriculum-items/?page=" << page
-			<< "&page_size=" << page_size
-			<< "&fields[lecture]=asset,title,object_index,asset_type,supplementary_assets,description,download_url,is_free,last_watched_second"
-			<< "&fields[asset]=stream_urls,download_urls,download_url,captions,title,filename,data,body,hls_url,media_sources,asset_type,length,media_license_token,course_is_drmed,thumbnail_sprite,slides,slide_urls,external_url"
-			<< "&fields[chapter]=title,object_index"
-			<< "&fields[supplementary_asset]=id,title,asset_type,download_urls,external_url,filename";
-
-		auto body = udemy_get(url.str(), 20000);
+		auto body = udemy_get(curriculum_url(course_id, page, page_size), 20000);
 		nlohmann::json raw = nlohmann::json::parse(body);
 
 		out["count"] = raw.value("count", 0);
@@ -760,65 +997,421 @@ RequestHandler::handleLectures(int course_id, int page, int page_size) {
 		return { status::bad_request, out.dump() };
 	}
 }
+std::string RequestHandler::curriculum_url(int course_id, int page, int page_size) const {
+	// subscriber-curriculum-items => chapter + lecture + asset
+	std::ostringstream url;
+	url << api_base_
+		<< "/api-2.0/courses/" << course_id
+		<< "/subscriber-curriculum-items/?page=" << page
+		<< "&page_size=" << page_size
+		<< "&fields[lecture]=asset,title,object_index,asset_type,supplementary_assets,description,download_url,is_free,last_watched_second"
+		<< "&fields[asset]=stream_urls,download_urls,download_url,captions,title,filename,data,body,hls_url,media_sources,asset_type,length,media_license_token,course_is_drmed,thumbnail_sprite,slides,slide_urls,external_url"
+		<< "&fields[chapter]=title,object_index"
+		<< "&fields[supplementary_asset]=id,title,asset_type,download_urls,external_url,filename";
+	return url.str();
+}
 
-std::pair<boost::beast::http::status, std::string>
-RequestHandler::handleQueueAdd(const std::string& body) {
+std::string RequestHandler::fetch_course_title(int course_id) {
+	std::ostringstream url;
+	url << api_base_ << "/api-2.0/courses/" << course_id << "/?fields[course]=title";
+	json raw = json::parse(udemy_get(url.str(), 15000));
+	std::string title = raw.value("title", std::string{});
+	return title.empty() ? std::to_string(course_id) : title;
+}
+
+std::pair<boost::beast::http::status, std::string> RequestHandler::handleCourseDownload(const std::string& body) {
 	using status = boost::beast::http::status;
 	json out;
-
 	try
 	{
 		json in = json::parse(body);
 
-		int lecture_id = in.value("lecture_id", 0);
-		int asset_id = in.value("asset_id", 0);
+		CourseFeed f;
+		f.course_id = in.value("course_id", 0);
+		if (!f.course_id) throw std::runtime_error("missing course_id");
+		if (token_.empty()) throw std::runtime_error("not authenticated");
+		f.title = in.value("course_title", std::string{});
+		f.quality = in.value("quality", std::string{ "720" });
+		f.subs = in.value("subs", download_subtitles_);
+		f.assets = in.value("assets", download_assets_);
+		f.deadline_min = std::max(0.0, in.value("deadline_min", 0.0));
 
-		std::string in_url = in.value("url", std::string{});
-		if (in_url.empty())
 		{
-			if (asset_id && in.value("course_id", 0) && lecture_id)
+			std::lock_guard<std::mutex> lk(mtx_);
+			auto it = feeds_.find(f.course_id);
+			if (it != feeds_.end() && (it->second.state == "pending" || it->second.state == "running"))
 			{
-				in_url = resolve_supplementary_asset(in["course_id"].get<int>(), lecture_id, asset_id);
+				out["ok"] = true;
+				out["started"] = false;
+				out["reason"] = "running";
+				return { status::ok, out.dump() };
 			}
-			else
+			feeds_[f.course_id] = f;
+			feed_pending_.push_back(f.course_id);
+			if (f.deadline_min <= 0.0) planner_.drop(f.course_id);
+		}
+		feed_cv_.notify_one();
+
+		out["ok"] = true;
+		out["started"] = true;
+		out["course_id"] = f.course_id;
+		return { status::ok, out.dump() };
+	}
+	catch (const std::exception& e)
+	{
+		out["ok"] = false;
+		out["error"] = e.what();
+		return { status::bad_request, out.dump() };
+	}
+}
+
+void RequestHandler::feeder_loop() {
+	while (true)
+	{
+		int course_id = 0;
+		{
+			std::unique_lock<std::mutex> lk(mtx_);
+			feed_cv_.wait(lk, [&] { return !feed_pending_.empty() || stop_; });
+			if (stop_) break;
+			course_id = feed_pending_.front();
+			feed_pending_.pop_front();
+		}
+		feed_course(course_id);
+	}
+}
+
+// Runs on feeder_. Each curriculum page is turned into jobs and enqueued
+// before the next page is requested, so the worker starts on the first
+// lectures while the rest of the course is still being listed.
+void RequestHandler::feed_course(int course_id) {
+	CourseFeed f;
+	std::string container;  // pinned on HLS videos that carry their captions
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		auto& live = feeds_[course_id];
+		live.state = "running";
+		f = live;
+		if (embed_captions_ && hls_container_ != "ts") container = hls_container_;
+	}
+
+	auto slug_name = [](const std::string& name)
+		{
+			auto dot = name.rfind('.');
+			if (dot == std::string::npos || dot == 0) return Helper::slugify(name);
+			return Helper::slugify(name.substr(0, dot)) + "." + Helper::slugify(name.substr(dot + 1));
+		};
+
+	try
+	{
+		if (f.title.empty()) f.title = fetch_course_title(course_id);
+
+		// deadline mode: HLS lectures are queued without a url and pick their
+		// variant when resolved at dispatch, against the time left
+		const bool deadline = f.deadline_min > 0.0;
+		if (deadline)
+		{
+			double total = 0.0;
+			try
 			{
-				throw std::runtime_error("missing url");
+				std::ostringstream url;
+				url << api_base_ << "/api-2.0/courses/" << course_id << "/?fields[course]=content_length_video";
+				total = json::parse(udemy_get(url.str(), 15000)).value("content_length_video", 0.0);
 			}
+			catch (...) {}  // summed from the lecture lengths instead
+
+			std::lock_guard<std::mutex> lk(mtx_);
+			planner_.plan(course_id, now_sec() + f.deadline_min * 60.0, total);
 		}
 
-		// ---- job ----
-		Job j;
-		j.id = next_id_++;
-		j.url = in_url;
-		j.filename = in.value("filename", "");
+		int page = 1, section_index = 0, lecture_no = 0;
+		std::string section_title;
+		std::unordered_map<std::string, std::unordered_set<int>> lectures_in_dir;  // by out_path_dir, read once
+
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lk(mtx_);
+				if (stop_) return;
+			}
+
+			json raw = json::parse(udemy_get(curriculum_url(course_id, page, 100), 20000));
+			if (!(raw.contains("results") && raw["results"].is_array())) break;
+
+			std::vector<Job> jobs;
+			int skipped = 0, lectures = 0;
+			double page_media = 0.0;
+			for (auto& it : raw["results"])
+			{
+				const std::string klass = it.value("_class", it.value("type", ""));
+				if (klass == "chapter")
+				{
+					section_index += 1;
+					section_title = it.value("title", "");
+					continue;
+				}
+				if (klass != "lecture") continue;
 
-		j.course_id = in.value("course_id", 0);
-		j.course_title = in.value("course_title", std::string{});
+				++lecture_no;
+				++lectures;
+				const json asset = it.contains("asset") ? it["asset"] : json{};
+				if (!asset.is_object() || asset.value("asset_type", "") != "Video") { ++skipped; continue; }
 
-		j.section_index = in.value("section_index", 0);
-		j.section_title = in.value("section_title", std::string{});
-		j.lecture_index = in.value("lecture_index", 0);
-		j.lecture_title = in.value("lecture_title", std::string{});
+				std::string video_url = pick_from_asset_for_size(asset, f.quality);
+				if (video_url.empty()) { ++skipped; continue; }
 
-		if (j.course_id && !j.course_title.empty())
-		{
-			j.out_path_dir = Helper::course_dir(j.course_id, j.course_title);
-			if (!j.section_title.empty() && j.section_index > 0)
+				json base;
+				base["course_id"] = course_id;
+				base["course_title"] = f.title;
+				base["section_index"] = section_index;
+				base["section_title"] = section_title;
+				base["lecture_index"] = lecture_no;
+				base["lecture_title"] = it.value("title", "");
+				base["lecture_id"] = it.value("id", 0);
+
+				const std::string prefix = Helper::zpad(lecture_no, 3) + " - " + Helper::slugify(it.value("title", ""));
+				std::vector<json> specs;
+
+				std::string lower_url = video_url;
+				std::transform(lower_url.begin(), lower_url.end(), lower_url.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+				const bool is_hls = lower_url.find(".m3u8") != std::string::npos;
+				if (asset.contains("length") && asset["length"].is_number()) page_media += asset["length"].get<double>();
+
+				json video = base;
+				if (!(deadline && is_hls)) video["url"] = video_url;
+				video["quality"] = f.quality;
+
+				// with embed_captions an HLS lecture muxes its captions in the same pass
+				const bool embed = !container.empty() && is_hls;
+				if (embed) video["container"] = container;
+
+				if (f.subs && asset.contains("captions") && asset["captions"].is_array())
+				{
+					for (auto& cap : asset["captions"])
+					{
+						std::string url = cap.value("url", cap.value("file", cap.value("src", std::string{})));
+						if (url.empty()) continue;
+						if (embed)
+						{
+							std::string locale = cap.value("locale_id", cap.value("language", cap.value("label", std::string{ "und" })));
+							video["captions"].push_back({ {"lang", locale}, {"url", url} });
+							continue;
+						}
+						std::string lang = Helper::slugify(cap.value("language", cap.value("label", std::string{ "sub" })));
+						std::string path_part = url.substr(0, url.find_first_of("?#"));
+						auto dot = path_part.rfind('.');
+						std::string ext = dot == std::string::npos ? "vtt" : path_part.substr(dot + 1);
+
+						json sub = base;
+						sub["url"] = url;
+						sub["filename"] = prefix + "." + lang + "." + ext;
+						specs.push_back(std::move(sub));
+					}
+				}
+				specs.insert(specs.begin(), std::move(video));
+
+				if (f.assets && it.contains("supplementary_assets") && it["supplementary_assets"].is_array())
+				{
+					for (auto& a : it["supplementary_assets"])
+					{
+						std::string url;
+						if (a.contains("download_urls") && a["download_urls"].is_object())
+						{
+							for (auto& [k, arr] : a["download_urls"].items())
+							{
+								if (!arr.is_array() || arr.empty()) continue;
+								url = arr[0].value("file", arr[0].value("url", std::string{}));
+								if (!url.empty()) break;
+							}
+						}
+						if (url.empty()) continue;
+
+						std::string name = a.value("filename", std::string{});
+						json extra = base;
+						extra["url"] = url;
+						extra["asset_id"] = a.value("id", 0);
+						extra["filename"] = prefix + " - " + (name.empty() ? Helper::slugify(a.value("title", std::string{ "asset" })) : slug_name(name));
+						specs.push_back(std::move(extra));
+					}
+				}
+
+				for (auto& spec : specs)
+				{
+					Job j = job_from_spec(spec);
+
+					std::error_code fec;
+					auto out_dir = std::filesystem::u8path(j.out_path_dir);
+					auto on_disk = lectures_in_dir.find(j.out_path_dir);
+					if (on_disk == lectures_in_dir.end())
+					{
+						std::filesystem::create_directories(out_dir, fec);
+						on_disk = lectures_in_dir.emplace(j.out_path_dir, lectures_on_disk(out_dir)).first;
+					}
+					// a lecture video counts by its number, so files named by older
+					// versions (other title slug, quality label, .ts) are found too
+					const bool have = !j.quality.empty()
+						? on_disk->second.count(j.lecture_index) != 0
+						: std::filesystem::exists(out_dir / std::filesystem::u8path(j.filename), fec);
+					if (have) { ++skipped; continue; }
+					jobs.push_back(std::move(j));
+				}
+			}
+
+			int queued = 0;
 			{
-				j.out_path_dir += "/" + Helper::section_dir(j.section_index, j.section_title);
+				std::lock_guard<std::mutex> lk(mtx_);
+				std::vector<json> recs;
+				recs.reserve(jobs.size());
+				if (deadline) planner_.add_media(course_id, page_media);
+				for (auto& j : jobs)
+				{
+					json r = enqueue_locked(std::move(j), recs);
+					if (r.value("queued", false)) ++queued;
+					else ++skipped;
+				}
+				journal_events(recs);
+
+				auto& live = feeds_[course_id];
+				live.title = f.title;
+				live.total = raw.value("count", live.total);
+				live.lectures += lectures;
+				live.queued += queued;
+				live.skipped += skipped;
 			}
+			if (queued) cv_.notify_all();
+
+			if (raw.contains("next") && !raw["next"].is_null()) ++page;
+			else break;
 		}
-		else
+
+		std::lock_guard<std::mutex> lk(mtx_);
+		feeds_[course_id].state = "done";
+		end_plan_if_idle(course_id);
+	}
+	catch (const std::exception& e)
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		auto& live = feeds_[course_id];
+		live.state = "failed";
+		live.error = e.what();
+		end_plan_if_idle(course_id);
+	}
+}
+
+void RequestHandler::end_plan_if_idle(int course_id) {
+	auto it = feeds_.find(course_id);
+	if (it != feeds_.end() && (it->second.state == "pending" || it->second.state == "running")) return;
+	if (queue_.course_jobs(course_id).empty()) planner_.drop(course_id);
+}
+
+
+RequestHandler::Job RequestHandler::job_from_spec(const json& in) {
+	int lecture_id = in.value("lecture_id", 0);
+	int asset_id = in.value("asset_id", 0);
+
+	std::string quality = in.value("quality", std::string{});
+
+	// without a url the job must carry enough identity to be resolved at dispatch
+	std::string in_url = in.value("url", std::string{});
+	if (in_url.empty() && !(in.value("course_id", 0) && lecture_id && (asset_id || !quality.empty())))
+		throw std::runtime_error("missing url");
+
+	// ---- job ----
+	Job j;
+	j.url = in_url;
+	j.filename = in.value("filename", "");
+	j.lecture_id = lecture_id;
+	j.asset_id = asset_id;
+	j.quality = quality;
+	if (!j.url.empty()) j.url_ts = now_sec();
+
+	j.course_id = in.value("course_id", 0);
+	j.course_title = in.value("course_title", std::string{});
+
+	j.section_index = in.value("section_index", 0);
+	j.section_title = in.value("section_title", std::string{});
+	j.lecture_index = in.value("lecture_index", 0);
+	j.lecture_title = in.value("lecture_title", std::string{});
+	j.priority = in.value("priority", 0);
+	if (in.contains("container")) j.container = FFmpegHelper::container_name(in.value("container", std::string{}));
+	if (in.contains("captions") && in["captions"].is_array())
+	{
+		for (auto& c : in["captions"])
 		{
-			j.out_path_dir = "downloads/misc";
+			if (!c.is_object() || c.value("url", std::string{}).empty()) continue;
+			j.captions.emplace_back(c.value("lang", std::string{ "und" }), c.value("url", std::string{}));
 		}
+	}
 
-		if (j.filename.empty())
+	if (j.course_id && !j.course_title.empty())
+	{
+		j.out_path_dir = Helper::course_dir(j.course_id, j.course_title);
+		if (!j.section_title.empty() && j.section_index > 0)
 		{
-			std::string base = j.lecture_title.empty() ? "video" : Helper::slugify(j.lecture_title);
-			if (j.lecture_index > 0) base = Helper::zpad(j.lecture_index, 3) + " - " + base;
-			j.filename = base + ".mp4";
+			j.out_path_dir += "/" + Helper::section_dir(j.section_index, j.section_title);
 		}
+	}
+	else
+	{
+		j.out_path_dir = "downloads/misc";
+	}
+
+	if (j.filename.empty())
+	{
+		std::string base = j.lecture_title.empty() ? "video" : Helper::slugify(j.lecture_title);
+		if (j.lecture_index > 0) base = Helper::zpad(j.lecture_index, 3) + " - " + base;
+		j.filename = base + ".mp4";
+	}
+
+	j.headers = default_headers(j.url);
+
+	if (in.contains("headers") && in["headers"].is_array())
+		for (auto& h : in["headers"]) if (h.is_string()) j.headers.push_back(h.get<std::string>());
+
+	return j;
+}
+
+// caller holds mtx_; the "add" record goes to `journal` so batches are written once
+json RequestHandler::enqueue_locked(Job j, std::vector<json>& journal) {
+	json out;
+	if (Job* dup = queue_.find_active_duplicate(j.url, j.out_path_dir, j.filename))
+	{
+		out["ok"] = true;
+		out["queued"] = false;
+		out["skipped"] = true;
+		out["reason"] = "queued";
+		out["id"] = dup->id;
+		return out;
+	}
+
+	j.id = next_id_++;
+	if (j.course_id)
+	{
+		auto& cp = progress_[j.course_id];
+		if (cp.title.empty()) cp.title = j.course_title;
+		cp.total += 1;
+	}
+
+	if (paused_courses_.find(j.course_id) != paused_courses_.end())
+		j.state = Job::State::Paused;
+	journal.push_back({ {"ev", "add"}, {"job", job_to_json(j)} });
+
+	out["ok"] = true;
+	out["queued"] = true;
+	out["id"] = j.id;
+	Job& q = queue_.insert(std::move(j));
+	if (q.state == Job::State::Queued) make_ready(q);
+	return out;
+}
+
+std::pair<boost::beast::http::status, std::string>
+RequestHandler::handleQueueAdd(const std::string& body) {
+	using status = boost::beast::http::status;
+	json out;
+
+	try
+	{
+		json in = json::parse(body);
+		Job j = job_from_spec(in);
 
 		{
 			std::error_code fec;
@@ -839,57 +1432,88 @@ RequestHandler::handleQueueAdd(const std::string& body) {
 			}
 		}
 
-		if (j.course_id)
 		{
-			auto& cp = progress_[j.course_id];
-			if (cp.title.empty()) cp.title = j.course_title;
-			cp.total += 1;
+			std::lock_guard<std::mutex> lk(mtx_);
+			std::vector<json> recs;
+			out = enqueue_locked(std::move(j), recs);
+			journal_events(recs);
 		}
 
-		j.headers.push_back(std::string("User-Agent: ") + kDefaultUserAgent);
-		j.headers.push_back("Referer: https://www.udemy.com/");
-		j.headers.push_back("Origin: https://www.udemy.com");
+		cv_.notify_all();  // two lanes wait on cv_ with different predicates
+		return { status::ok, out.dump() };
+	}
+	catch (const std::exception& e)
+	{
+		out["ok"] = false;
+		out["error"] = e.what();
+		return { status::bad_request, out.dump() };
+	}
+}
+
+std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueueBatch(const std::string& body) {
+	using status = boost::beast::http::status;
+	json out;
 
-		append_auth_headers_for_url(j.url, j.headers);
+	try
+	{
+		json in = json::parse(body);
+		const json& specs = in.is_array() ? in : in.value("items", json::array());
+		if (!specs.is_array()) throw std::runtime_error("items must be an array");
 
-		if (in.contains("headers") && in["headers"].is_array())
-			for (auto& h : in["headers"]) if (h.is_string()) j.headers.push_back(h.get<std::string>());
+		// validate and stat outside the lock; each directory is created once
+		std::vector<json> results(specs.size());
+		std::vector<std::pair<size_t, Job>> pending;
+		pending.reserve(specs.size());
+		std::unordered_set<std::string> made_dirs;
 
+		for (size_t i = 0; i < specs.size(); ++i)
 		{
-			std::lock_guard<std::mutex> lk(mtx_);
+			try
+			{
+				Job j = job_from_spec(specs[i]);
 
-			auto dup = std::find_if(
-				queue_.begin(), queue_.end(),
-				[&](const Job& q)
-				{
-					return (q.url == j.url ||
-						(q.out_path_dir == j.out_path_dir &&
-							q.filename == j.filename)) &&
-						q.state != Job::State::Done &&
-						q.state != Job::State::Failed;
-				});
+				std::error_code fec;
+				auto out_dir = std::filesystem::u8path(j.out_path_dir);
+				if (made_dirs.insert(j.out_path_dir).second)
+					std::filesystem::create_directories(out_dir, fec);
 
-			if (dup != queue_.end())
+				auto final_path = out_dir / std::filesystem::u8path(j.filename);
+				if (std::filesystem::exists(final_path, fec))
+				{
+					results[i] = { {"ok", true}, {"queued", false}, {"skipped", true}, {"reason", "exists"},
+								   {"path", Helper::path_to_utf8(final_path)} };
+					continue;
+				}
+				pending.emplace_back(i, std::move(j));
+			}
+			catch (const std::exception& e)
 			{
-				json out2;
-				out2["ok"] = true;
-				out2["queued"] = false;
-				out2["skipped"] = true;
-				out2["reason"] = "queued";
-				out2["id"] = dup->id;
-				return { status::ok, out2.dump() };
+				results[i] = { {"ok", false}, {"error", e.what()} };
 			}
+		}
 
-			if (paused_courses_.find(j.course_id) != paused_courses_.end())
-				j.state = Job::State::Paused;
-			queue_.push_back(std::move(j));
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			std::vector<json> recs;
+			recs.reserve(pending.size());
+			for (auto& [i, j] : pending) results[i] = enqueue_locked(std::move(j), recs);
+			journal_events(recs);
 		}
+		cv_.notify_all();
 
-		cv_.notify_one();
+		int queued = 0, skipped = 0, failed = 0;
+		for (auto& r : results)
+		{
+			if (!r.value("ok", false)) ++failed;
+			else if (r.value("queued", false)) ++queued;
+			else ++skipped;
+		}
 
 		out["ok"] = true;
-		out["queued"] = true;
-		out["id"] = j.id;
+		out["queued"] = queued;
+		out["skipped"] = skipped;
+		out["failed"] = failed;
+		out["results"] = std::move(results);
 		return { status::ok, out.dump() };
 	}
 	catch (const std::exception& e)
@@ -904,29 +1528,59 @@ RequestHandler::handleQueueAdd(const std::string& body) {
 std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueueList() {
 	json out;
 	out["ok"] = true;
-	out["running"] = running_;
 	out["items"] = json::array();
 
-	auto jstate = [](RequestHandler::Job::State s) -> const char*
+	std::lock_guard<std::mutex> lk(mtx_);
+	out["running"] = !running_.empty();
+	out["active"] = running_.size();
+	out["limit"] = controller_.limit();
+	out["policy"] = JobScheduler::policy_name(scheduler_.policy());
+	out["ready"] = scheduler_.size();
+	out["ready_small"] = small_ready_.size();
+	out["items"] = json::array();
+	const double ts = now_sec();
+	for (auto& j : queue_)
+	{
+		// lock-free snapshot of the transfer's counters; speed EWMA is computed here, not in the callback
+		if (j.state == Job::State::Downloading && j.slot)
 		{
-			using S = RequestHandler::Job::State;
-			switch (s)
+			j.bytes_now = j.slot->bytes_now.load(std::memory_order_relaxed);
+			j.bytes_total = j.slot->bytes_total.load(std::memory_order_relaxed);
+			j.media_now = j.slot->media_ms_now.load(std::memory_order_relaxed) / 1000.0;
+			j.media_total = j.slot->media_ms_total.load(std::memory_order_relaxed) / 1000.0;
+			if (j.slot->total_us.load(std::memory_order_relaxed) > 0) j.stages = j.slot->load_stages();
+			// HLS byte totals are extrapolated; stream time against the playlist is exact
+			if (j.media_total > 0.0)
+				j.progress = std::min(100.0, j.media_now * 100.0 / j.media_total);
+			else if (j.bytes_total > 0)
+				j.progress = (j.bytes_now * 100.0) / (double)j.bytes_total;
+
+			if (j.sample_ts <= 0.0 || j.bytes_now < j.sample_bytes || j.media_now < j.sample_media)
 			{
-			case S::Queued:       return "queued";
-			case S::Downloading:  return "downloading";
-			case S::Done:         return "done";
-			case S::Failed:       return "failed";
-			case S::Paused:       return "paused";
+				j.sample_ts = ts;
+				j.sample_bytes = j.bytes_now;
+				j.sample_media = j.media_now;
 			}
-			return "unknown";
-		};
+			else if (ts - j.sample_ts >= 0.25)
+			{
+				double inst = (double)(j.bytes_now - j.sample_bytes) / (ts - j.sample_ts); // B/s
+				if (j.speed_bps <= 0) j.speed_bps = inst;
+				else                  j.speed_bps = 0.25 * inst + 0.75 * j.speed_bps;
+				double inst_media = (j.media_now - j.sample_media) / (ts - j.sample_ts);
+				if (j.media_rate <= 0) j.media_rate = inst_media;
+				else                   j.media_rate = 0.25 * inst_media + 0.75 * j.media_rate;
+				j.sample_ts = ts;
+				j.sample_bytes = j.bytes_now;
+				j.sample_media = j.media_now;
+			}
+		}
 
-	std::lock_guard<std::mutex> lk(mtx_);
-	out["items"] = json::array();
-	for (auto const& j : queue_)
-	{
 		double eta = -1.0;
-		if (j.state == Job::State::Downloading &&
+		if (j.state == Job::State::Downloading && j.media_total > 0.0)
+		{
+			if (j.media_rate > 0.01) eta = std::max(0.0, j.media_total - j.media_now) / j.media_rate;
+		}
+		else if (j.state == Job::State::Downloading &&
 			j.speed_bps > 1.0 &&
 			j.bytes_total > 0 &&
 			j.bytes_now >= 0 &&
@@ -940,7 +1594,7 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueueLi
 		it["id"] = j.id;
 		it["url"] = j.url;
 		it["filename"] = j.filename;
-		it["state"] = jstate(j.state);
+		it["state"] = state_name(j.state);
 		it["progress"] = j.progress;
 		it["message"] = j.message;
 		it["out_path"] = j.out_path;
@@ -951,12 +1605,27 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueueLi
 		it["section_title"] = j.section_title;
 		it["lecture_index"] = j.lecture_index;
 		it["lecture_title"] = j.lecture_title;
+		it["priority"] = j.priority;
+		it["url_refreshes"] = j.url_refreshes;
+		it["reconnects"] = j.reconnects;
+		if (j.net_bytes) it["net_bytes"] = j.net_bytes;
+		if (j.stages.total_ms > 0.0) it["hls_stages"] = stages_to_json(j.stages);
+		it["attempts"] = j.attempts;
+		if (!j.error_class.empty()) it["error_class"] = j.error_class;
+		if (j.state == Job::State::Retrying) it["retry_in_sec"] = std::max(0.0, j.retry_at - ts);
 
 		it["out_dir"] = j.out_path_dir;
 
 		it["bytes_now"] = j.bytes_now;
 		it["bytes_total"] = j.bytes_total;
 		it["speed_bps"] = j.speed_bps;
+		if (j.bytes_total > 0) it["progress_bytes"] = std::min(100.0, (j.bytes_now * 100.0) / (double)j.bytes_total);
+		if (j.media_total > 0.0)
+		{
+			it["media_sec"] = j.media_now;
+			it["media_total_sec"] = j.media_total;
+			it["progress_time"] = std::min(100.0, j.media_now * 100.0 / j.media_total);
+		}
 
 		it["eta_sec"] = eta;
 
@@ -971,10 +1640,26 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueueLi
 		c["title"] = cp.title;
 		c["done"] = cp.done;
 		c["total"] = cp.total;
+		c["failed"] = cp.failed;
 		courses.push_back(std::move(c));
 	}
 	out["courses"] = courses;
 
+	json feeds = json::array();
+	for (auto const& [cid, f] : feeds_)
+	{
+		json c;
+		c["course_id"] = cid;
+		c["state"] = f.state;
+		c["total"] = f.total;
+		c["lectures"] = f.lectures;
+		c["queued"] = f.queued;
+		c["skipped"] = f.skipped;
+		if (!f.error.empty()) c["error"] = f.error;
+		feeds.push_back(std::move(c));
+	}
+	out["feeds"] = feeds;
+
 	return { boost::beast::http::status::ok, out.dump() };
 }
 
@@ -984,23 +1669,47 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueuePa
 	try
 	{
 		json in = json::parse(body);
+		uint64_t id = in.value("id", 0ULL);
 		int course_id = in.value("course_id", 0);
-		if (!course_id) throw std::runtime_error("missing course_id");
+		if (!id && !course_id) throw std::runtime_error("missing id or course_id");
 
+		int changed = 0;
 		{
 			std::lock_guard<std::mutex> lk(mtx_);
-			paused_courses_.insert(course_id);
-			for (auto& q : queue_)
-			{
-				if (q.course_id == course_id &&
-					q.state == Job::State::Queued)
+			// running transfers stop at their next progress tick and are parked by the worker
+			auto pause = [&](Job& q)
 				{
+					if (q.state == Job::State::Queued) unready(q.id);
+					else if (q.state == Job::State::Retrying) retry_due_.erase({ q.retry_at, q.id });
+					else if (q.state == Job::State::Downloading && q.slot)
+					{
+						q.slot->control.store(static_cast<int>(TransferControl::Pause), std::memory_order_relaxed);
+						++changed;
+						return false;
+					}
+					else return false;
+
 					q.state = Job::State::Paused;
-				}
+					++changed;
+					return true;
+				};
+
+			if (id)
+			{
+				Job* q = queue_.find(id);
+				if (q && pause(*q)) journal_event({ {"ev", "state"}, {"id", id}, {"state", "paused"} });
+			}
+			else
+			{
+				paused_courses_.insert(course_id);
+				journal_event({ {"ev", "pause"}, {"course_id", course_id} });
+				for (uint64_t qid : queue_.course_jobs(course_id))
+					if (Job* q = queue_.find(qid)) pause(*q);
 			}
 		}
 
 		out["ok"] = true;
+		out["changed"] = changed;
 		return { status::ok, out.dump() };
 	}
 	catch (const std::exception& e)
@@ -1017,24 +1726,150 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueueRe
 	try
 	{
 		json in = json::parse(body);
+		uint64_t id = in.value("id", 0ULL);
+		int course_id = in.value("course_id", 0);
+		if (!id && !course_id) throw std::runtime_error("missing id or course_id");
+
+		int changed = 0;
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			auto resume = [&](Job& q)
+				{
+					if (q.state == Job::State::Paused)
+					{
+						q.state = Job::State::Queued;
+						make_ready(q);
+						++changed;
+						return true;
+					}
+					// a pause that has not reached the transfer yet is simply withdrawn
+					int want = static_cast<int>(TransferControl::Pause);
+					if (q.state == Job::State::Downloading && q.slot &&
+						q.slot->control.compare_exchange_strong(want, static_cast<int>(TransferControl::Run)))
+						++changed;
+					return false;
+				};
+
+			if (id)
+			{
+				Job* q = queue_.find(id);
+				if (q && resume(*q)) journal_event({ {"ev", "state"}, {"id", id}, {"state", "queued"} });
+			}
+			else
+			{
+				paused_courses_.erase(course_id);
+				journal_event({ {"ev", "resume"}, {"course_id", course_id} });
+				for (uint64_t qid : queue_.course_jobs(course_id))
+					if (Job* q = queue_.find(qid)) resume(*q);
+			}
+		}
+		cv_.notify_all();
+
+		out["ok"] = true;
+		out["changed"] = changed;
+		return { status::ok, out.dump() };
+	}
+	catch (const std::exception& e)
+	{
+		out["ok"] = false;
+		out["error"] = e.what();
+		return { status::bad_request, out.dump() };
+	}
+}
+
+std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueueCancel(const std::string& body) {
+	using status = boost::beast::http::status;
+	json out;
+	try
+	{
+		json in = json::parse(body);
+		uint64_t id = in.value("id", 0ULL);
 		int course_id = in.value("course_id", 0);
-		if (!course_id) throw std::runtime_error("missing course_id");
+		if (!id && !course_id) throw std::runtime_error("missing id or course_id");
 
+		int changed = 0;
+		std::vector<std::string> outputs;  // of jobs cancelled here, partial files removed after unlocking
 		{
 			std::lock_guard<std::mutex> lk(mtx_);
-			paused_courses_.erase(course_id);
-			for (auto& q : queue_)
+			std::vector<uint64_t> ids;
+			if (id) ids.push_back(id);
+			else ids.assign(queue_.course_jobs(course_id).begin(), queue_.course_jobs(course_id).end());
+
+			for (uint64_t qid : ids)
 			{
-				if (q.course_id == course_id &&
-					q.state == Job::State::Paused)
+				Job* q = queue_.find(qid);
+				if (!q || q->finished()) continue;
+				++changed;
+
+				if (q->state == Job::State::Downloading)
 				{
-					q.state = Job::State::Queued;
+					// the worker finishes it once the transfer has stopped
+					if (q->slot) q->slot->control.store(static_cast<int>(TransferControl::Cancel), std::memory_order_relaxed);
+					continue;
 				}
+				if (q->state == Job::State::Retrying) retry_due_.erase({ q->retry_at, q->id });
+				outputs.push_back(q->out_path.empty() ? q->out_path_dir + "/" + q->filename : q->out_path);
+				mark_cancelled(*q);
+				finish_job(*q);
+			}
+		}
+
+		// a running transfer drops these itself; paused or waiting jobs left them from an earlier attempt
+		for (auto& p : outputs)
+		{
+			std::error_code ec;
+			std::filesystem::remove(std::filesystem::u8path(p + ".part"), ec);
+			std::filesystem::remove_all(std::filesystem::u8path(p + ".segs"), ec);
+		}
+
+		out["ok"] = true;
+		out["changed"] = changed;
+		return { status::ok, out.dump() };
+	}
+	catch (const std::exception& e)
+	{
+		out["ok"] = false;
+		out["error"] = e.what();
+		return { status::bad_request, out.dump() };
+	}
+}
+
+std::pair<boost::beast::http::status, std::string> RequestHandler::handleQueuePriority(const std::string& body) {
+	using status = boost::beast::http::status;
+	json out;
+	try
+	{
+		json in = json::parse(body);
+		uint64_t id = in.value("id", 0ULL);
+		int course_id = in.value("course_id", 0);
+		if (!id && !course_id) throw std::runtime_error("missing id or course_id");
+		if (!in.contains("priority")) throw std::runtime_error("missing priority");
+		int priority = in.value("priority", 0);
+
+		int changed = 0;
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			auto apply = [&](Job& q)
+				{
+					q.priority = priority;
+					journal_event({ {"ev", "priority"}, {"id", q.id}, {"priority", priority} });
+					if (scheduler_.contains(q.id) || small_ready_.contains(q.id)) make_ready(q);
+					++changed;
+				};
+
+			if (id)
+			{
+				if (Job* q = queue_.find(id)) apply(*q);
+			}
+			else
+			{
+				for (uint64_t qid : queue_.course_jobs(course_id))
+					if (Job* q = queue_.find(qid)) apply(*q);
 			}
 		}
-		cv_.notify_one();
 
 		out["ok"] = true;
+		out["changed"] = changed;
 		return { status::ok, out.dump() };
 	}
 	catch (const std::exception& e)
@@ -1092,6 +1927,7 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleReconci
 			if (p.is_regular_file())
 			{
 				auto name = Helper::path_to_utf8(p.path().filename());
+				if (name == kManifestName) continue;
 				int idx = 0;
 				if (name.size() >= 3 &&
 					std::isdigit(static_cast<unsigned char>(name[0])) &&
@@ -1205,22 +2041,100 @@ std::pair<boost::beast::http::status, std::string> RequestHandler::handleEstimat
 }
 
 
+struct FileSink {
+	FILE* fp = nullptr;
+	Checksum::StreamHasher* hasher = nullptr; // hashes the bytes as they hit the disk
+	CURL* curl = nullptr;
+	bool resuming = false;       // a Range request was sent
+	bool range_ignored = false;  // ...and the server answered with the whole file
+};
+
 static size_t file_write(void* ptr, size_t size, size_t nmemb, void* userdata) {
-	FILE* fp = (FILE*)userdata;
-	return fwrite(ptr, size, nmemb, fp);
+	auto* sink = (FileSink*)userdata;
+	if (sink->resuming)
+	{
+		// appending a full body to the .part would corrupt it
+		long code = 0;
+		curl_easy_getinfo(sink->curl, CURLINFO_RESPONSE_CODE, &code);
+		sink->resuming = false;
+		if (code != 206)
+		{
+			sink->range_ignored = true;
+			return 0;
+		}
+	}
+	size_t n = fwrite(ptr, size, nmemb, sink->fp);
+	if (sink->hasher) sink->hasher->update(ptr, n * size);
+	return n;
 }
 
+// Progress plus stall detection for one connection. A transfer is torn down
+// when no byte arrives for kStallSec, or when it runs below kSlowRatio of the
+// best rate this job has sustained for kSlowWindows windows in a row.
+struct StallWatch {
+	static constexpr double kStallSec = 30.0;
+	static constexpr double kWindowSec = 10.0;
+	static constexpr double kSlowRatio = 0.15;
+	static constexpr int kSlowWindows = 2;
+
+	std::function<void(double, double)>* progress = nullptr;
+	double* typical_bps = nullptr;   // TransferContext::typical_bps, survives reconnects
+	const TransferContext* ctx = nullptr;  // pause/cancel requests
+
+	double last_data_ts = 0.0;
+	curl_off_t last_now = 0;
+	double window_ts = 0.0;
+	curl_off_t window_bytes = 0;
+	int slow_windows = 0;
+	const char* stalled = nullptr;   // reason, set when the callback aborted
+};
+
 static int curl_xferinfo_trampoline(void* clientp,
 	curl_off_t dltotal, curl_off_t dlnow,
 	curl_off_t /*ultotal*/, curl_off_t /*ulnow*/) {
-	using CB = std::function<void(double, double)>;
-	auto* cb = reinterpret_cast<CB*>(clientp);
-	if (cb && *cb) (*cb)(static_cast<double>(dlnow), static_cast<double>(dltotal));
+	auto* w = reinterpret_cast<StallWatch*>(clientp);
+	if (w->progress && *w->progress) (*w->progress)(static_cast<double>(dlnow), static_cast<double>(dltotal));
+	if (w->ctx && w->ctx->stop_requested()) return 1;
+
+	const double ts = now_sec();
+	if (w->last_data_ts <= 0.0) w->last_data_ts = w->window_ts = ts;
+	if (dlnow != w->last_now)
+	{
+		w->last_now = dlnow;
+		w->last_data_ts = ts;
+	}
+	if (ts - w->last_data_ts > StallWatch::kStallSec)
+	{
+		w->stalled = "no data";
+		return 1;
+	}
+
+	if (ts - w->window_ts >= StallWatch::kWindowSec)
+	{
+		double rate = (dlnow - w->window_bytes) / (ts - w->window_ts);
+		w->window_ts = ts;
+		w->window_bytes = dlnow;
+
+		double& typical = *w->typical_bps;
+		if (typical > 0.0 && rate < typical * StallWatch::kSlowRatio)
+		{
+			if (++w->slow_windows >= StallWatch::kSlowWindows)
+			{
+				w->stalled = "slow";
+				return 1;
+			}
+		}
+		else
+		{
+			w->slow_windows = 0;
+		}
+		typical = std::max(typical, rate);
+	}
 	return 0; // continue
 }
 
 
-bool RequestHandler::curl_download_file(const std::string& url, const std::string& out_path, const std::vector<std::string>& extra_headers, std::function<void(double, double)> on_progress, std::string& msg) {
+bool RequestHandler::curl_download_file(const std::string& url, const std::string& out_path, const std::vector<std::string>& extra_headers, std::function<void(double, double)> on_progress, std::string& msg, TransferContext* ctx) {
 	msg.clear();
 	auto out_fs = std::filesystem::u8path(out_path);
 	auto tmp_path = out_fs;
@@ -1239,45 +2153,139 @@ bool RequestHandler::curl_download_file(const std::string& url, const std::strin
 	FILE* fp = Helper::xfopen(tmp_utf8.c_str(), already ? "ab" : "wb");
 	if (!fp) { msg = "cannot open file"; return false; }
 
-	CurlHandle ch;
-	if (!ch.h) { fclose(fp); msg = "curl init failed"; return false; }
+	std::unique_ptr<Checksum::StreamHasher> hasher;
+	if (ctx)
+	{
+		hasher = std::make_unique<Checksum::StreamHasher>(ctx->want_sha256);
+		std::string herr;
+		if (already > 0 && !hasher->update_from_file(tmp_utf8, herr))
+			hasher.reset(); // fall back to hashing the finished file
+	}
+	// a fast-lane worker hands in its own handle: reset, it keeps the
+	// connection to the CDN open from one small file to the next
+	CurlHandle own(!(ctx && ctx->easy));
+	CURL* const h = own.h ? own.h : ctx->easy;
+	if (!h) { fclose(fp); msg = "curl init failed"; return false; }
+	if (!own.h) curl_easy_reset(h);
+	FileSink sink{ fp, hasher.get(), h, already > 0 };
+
+	// curl counts from the resume offset; report whole-file numbers
+	std::function<void(double, double)> progress = [&](double now, double total)
+		{
+			if (on_progress) on_progress(now + already, total > 0 ? total + already : 0.0);
+		};
 
 	// header list
 	struct curl_slist* hdr = nullptr;
 	for (auto& h : extra_headers) hdr = curl_slist_append(hdr, h.c_str());
 
-	curl_easy_setopt(ch.h, CURLOPT_URL, url.c_str());
-	curl_easy_setopt(ch.h, CURLOPT_FOLLOWLOCATION, 1L);
-	curl_easy_setopt(ch.h, CURLOPT_MAXREDIRS, 8L);
-	curl_easy_setopt(ch.h, CURLOPT_USERAGENT, kDefaultUserAgent);
-	curl_easy_setopt(ch.h, CURLOPT_ACCEPT_ENCODING, ""); // gzip
-	curl_easy_setopt(ch.h, CURLOPT_HTTPHEADER, hdr);
-	curl_easy_setopt(ch.h, CURLOPT_WRITEDATA, fp);
-	curl_easy_setopt(ch.h, CURLOPT_WRITEFUNCTION, file_write);
-
-	curl_easy_setopt(ch.h, CURLOPT_NOPROGRESS, 0L);
-	curl_easy_setopt(ch.h, CURLOPT_XFERINFOFUNCTION, curl_xferinfo_trampoline);
-	curl_easy_setopt(ch.h, CURLOPT_XFERINFODATA, &on_progress);
+	curl_easy_setopt(h, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(h, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(h, CURLOPT_MAXREDIRS, 8L);
+	curl_easy_setopt(h, CURLOPT_USERAGENT, kDefaultUserAgent);
+	curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, ""); // gzip
+	curl_easy_setopt(h, CURLOPT_HTTPHEADER, hdr);
+	curl_easy_setopt(h, CURLOPT_WRITEDATA, &sink);
+	curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, file_write);
+
+	curl_easy_setopt(h, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(h, CURLOPT_XFERINFOFUNCTION, curl_xferinfo_trampoline);
+	double typical_local = 0.0;
+	StallWatch watch;
+	watch.progress = &progress;
+	watch.typical_bps = ctx ? &ctx->typical_bps : &typical_local;
+	watch.ctx = ctx;
+	curl_easy_setopt(h, CURLOPT_XFERINFODATA, &watch);
+	curl_easy_setopt(h, CURLOPT_FAILONERROR, 1L); // error bodies never reach the file
+
+	if (ctx && ctx->small_lane && share_ && share_->sh)
+	{
+		curl_easy_setopt(h, CURLOPT_SHARE, share_->sh);
+		curl_easy_setopt(h, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+	}
 
-	curl_easy_setopt(ch.h, CURLOPT_CONNECTTIMEOUT_MS, 8000L);
-	curl_easy_setopt(ch.h, CURLOPT_TIMEOUT, 0L); // sınırsız
-	curl_easy_setopt(ch.h, CURLOPT_SSL_VERIFYPEER, 1L);
-	curl_easy_setopt(ch.h, CURLOPT_SSL_VERIFYHOST, 2L);
+	curl_easy_setopt(h, CURLOPT_CONNECTTIMEOUT_MS, 8000L);
+	curl_easy_setopt(h, CURLOPT_TIMEOUT, 0L); // sınırsız
+	curl_easy_setopt(h, CURLOPT_SSL_VERIFYPEER, 1L);
+	curl_easy_setopt(h, CURLOPT_SSL_VERIFYHOST, 2L);
 
 	if (!proxy_.empty())
-		curl_easy_setopt(ch.h, CURLOPT_PROXY, proxy_.c_str());
+		curl_easy_setopt(h, CURLOPT_PROXY, proxy_.c_str());
 
 	// resume
 	if (already > 0)
-		curl_easy_setopt(ch.h, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(already));
+		curl_easy_setopt(h, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(already));
 
-	CURLcode rc = curl_easy_perform(ch.h);
+	// after a stall: new connection and a fresh DNS answer, which on a
+	// round-robin CDN usually means a different edge
+	if (ctx && ctx->reconnects > 0)
+	{
+		curl_easy_setopt(h, CURLOPT_FRESH_CONNECT, 1L);
+		curl_easy_setopt(h, CURLOPT_FORBID_REUSE, 1L);
+		curl_easy_setopt(h, CURLOPT_DNS_CACHE_TIMEOUT, 0L);
+	}
+
+	CURLcode rc = curl_easy_perform(h);
 	if (hdr) curl_slist_free_all(hdr);
 	fclose(fp);
 
+	curl_off_t got = 0;
+	if (ctx && curl_easy_getinfo(h, CURLINFO_SIZE_DOWNLOAD_T, &got) == CURLE_OK) ctx->net_bytes += got;
+
+	long code = 0;
+	curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &code);
+
+	char* ip = nullptr;
+	std::string edge = (curl_easy_getinfo(h, CURLINFO_PRIMARY_IP, &ip) == CURLE_OK && ip) ? ip : "";
+
+	// paused or cancelled from the queue: whatever arrived stays in the .part
+	if (rc == CURLE_ABORTED_BY_CALLBACK && ctx && ctx->stop_requested())
+	{
+		ctx->edge_ip = edge;
+		msg = "stopped";
+		return false;
+	}
+
+	if (rc == CURLE_ABORTED_BY_CALLBACK && watch.stalled && ctx && ctx->reconnects < kMaxReconnects)
+	{
+		ctx->reconnects += 1;
+		std::cout << "[download] " << watch.stalled << " transfer from " << (edge.empty() ? "?" : edge)
+			<< ", reconnecting (" << ctx->reconnects << ")\n";
+		ctx->edge_ip = edge;
+		return curl_download_file(url, out_path, extra_headers, on_progress, msg, ctx);
+	}
+	if (ctx) ctx->edge_ip = edge;
+
+	// no usable range support (200 instead of 206, or 416): start the file over
+	if (already > 0 && (sink.range_ignored || code == 416))
+	{
+		std::error_code rec;
+		std::filesystem::remove(tmp_path, rec);
+		return curl_download_file(url, out_path, extra_headers, on_progress, msg, ctx);
+	}
+
 	if (rc != CURLE_OK)
 	{
-		msg = curl_easy_strerror(rc);
+		if (rc == CURLE_HTTP_RETURNED_ERROR && code >= 400)
+		{
+			if (ctx)
+			{
+				ctx->http_status = code;
+				curl_off_t wait = 0;
+				if (curl_easy_getinfo(h, CURLINFO_RETRY_AFTER, &wait) == CURLE_OK) ctx->retry_after = static_cast<long>(wait);
+			}
+			msg = "http " + std::to_string(code);
+		}
+		else if (rc == CURLE_ABORTED_BY_CALLBACK && watch.stalled)
+		{
+			if (ctx) ctx->network_error = true;
+			msg = std::string("stalled (") + watch.stalled + ")";
+		}
+		else
+		{
+			if (ctx) ctx->network_error = is_network_error(rc);
+			msg = curl_easy_strerror(rc);
+		}
 		return false;
 	}
 
@@ -1285,6 +2293,20 @@ bool RequestHandler::curl_download_file(const std::string& url, const std::strin
 	std::filesystem::rename(tmp_path, out_fs, ec);
 	if (ec) { msg = "rename failed"; return false; }
 
+	if (ctx)
+	{
+		if (hasher)
+		{
+			ctx->xxh64 = hasher->xxh64_hex();
+			ctx->sha256 = hasher->sha256_hex();
+		}
+		else
+		{
+			std::string herr;
+			Checksum::hash_file(out_path, ctx->want_sha256, ctx->xxh64, ctx->sha256, herr);
+		}
+	}
+
 	return true;
 }
 
@@ -1311,6 +2333,12 @@ std::string RequestHandler::resolve_lecture_stream(int course_id, int lecture_id
 
 	auto& a = j["asset"];
 
+	bool planned = false;
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		planned = planner_.planned(course_id, now_sec());
+	}
+
 	auto is_exact_1080 = [](const std::string& s) -> bool
 		{
 			if (s.empty()) return false;
@@ -1321,7 +2349,7 @@ std::string RequestHandler::resolve_lecture_stream(int course_id, int lecture_id
 			return Helper::extract_quality_value(s) == 1080;
 		};
 
-	if (is_exact_1080(prefer_quality))
+	if (is_exact_1080(prefer_quality) || planned)
 	{
 		auto make_absolute = [](const std::string& base_url, const std::string& rel) -> std::string
 			{
@@ -1412,79 +2440,82 @@ std::string RequestHandler::resolve_lecture_stream(int course_id, int lecture_id
 				return out;
 			};
 
+		// Single-connection throughput: up to 4 MB of the first segment of
+		// the top variant, at most 5 s.
+		auto probe_link = [&](const std::string& master_url, const std::vector<VariantPlanner::Variant>& variants) -> double
+			{
+				const VariantPlanner::Variant* top = VariantPlanner::pick(variants, 0, 0.0);
+				if (!top) return 0.0;
+				std::string media_url = make_absolute(master_url, top->uri);
+				std::string segment;
+				std::istringstream ss(fetch_with_headers(media_url));
+				std::string line;
+				while (std::getline(ss, line))
+				{
+					line = Helper::trim(line);
+					if (!line.empty() && line[0] != '#') { segment = make_absolute(media_url, line); break; }
+				}
+				if (segment.empty()) return 0.0;
+
+				CurlHandle ch; if (!ch.h) return 0.0;
+				std::string sink;
+				curl_easy_setopt(ch.h, CURLOPT_URL, segment.c_str());
+				curl_easy_setopt(ch.h, CURLOPT_FOLLOWLOCATION, 1L);
+				curl_easy_setopt(ch.h, CURLOPT_USERAGENT, kDefaultUserAgent);
+				curl_easy_setopt(ch.h, CURLOPT_RANGE, "0-4194303");
+				curl_easy_setopt(ch.h, CURLOPT_WRITEFUNCTION, Helper::write_to_string);
+				curl_easy_setopt(ch.h, CURLOPT_WRITEDATA, &sink);
+				curl_easy_setopt(ch.h, CURLOPT_CONNECTTIMEOUT_MS, 8000L);
+				curl_easy_setopt(ch.h, CURLOPT_TIMEOUT_MS, 5000L);
+				if (!proxy_.empty()) curl_easy_setopt(ch.h, CURLOPT_PROXY, proxy_.c_str());
+				CURLcode rc = curl_easy_perform(ch.h);
+				if (rc != CURLE_OK && rc != CURLE_OPERATION_TIMEDOUT) return 0.0;
+
+				curl_off_t speed = 0;
+				curl_easy_getinfo(ch.h, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+				return static_cast<double>(speed);
+			};
+
 		auto pick_variant_from_master = [&](const std::string& master_url, const std::string& playlist) -> std::string
 			{
 				if (playlist.find("#EXT-X-KEY") != std::string::npos)
 					throw std::runtime_error("Encrypted stream. Exiting.");
 
-				struct Variant {
-					std::string uri;
-					int width = 0;
-					int height = 0;
-					long long bandwidth = 0;
-				};
+				using Variant = VariantPlanner::Variant;
+				std::vector<Variant> variants = VariantPlanner::parse_master(playlist);
+				if (variants.empty()) return {};
 
-				std::vector<Variant> variants;
-				std::istringstream ss(playlist);
-				std::string line;
-				while (std::getline(ss, line))
+				if (planned)
 				{
-					if (!line.empty() && line.back() == '\r') line.pop_back();
-					std::string trimmed = Helper::trim(line);
-					if (trimmed.rfind("#EXT-X-STREAM-INF", 0) != 0) continue;
-
-					Variant v;
-					auto colon = trimmed.find(':');
-					std::string attrs = (colon == std::string::npos) ? std::string{} : trimmed.substr(colon + 1);
-
-					auto find_attr = [&](const std::string& key) -> std::string
-						{
-							auto pos = attrs.find(key);
-							if (pos == std::string::npos) return {};
-							pos += key.size();
-							auto end = attrs.find(',', pos);
-							std::string val = (end == std::string::npos) ? attrs.substr(pos) : attrs.substr(pos, end - pos);
-							return Helper::trim(val);
-						};
-
-					std::string res = find_attr("RESOLUTION=");
-					auto x = res.find('x');
-					if (x != std::string::npos)
+					// link = the better of the probe and what the queue is moving right now
+					const double now = now_sec();
+					double probe = 0.0, live = 0.0;
 					{
-						try
-						{
-							v.width = std::stoi(res.substr(0, x));
-							v.height = std::stoi(res.substr(x + 1));
-						}
-						catch (...)
-						{
-							v.width = v.height = 0;
-						}
+						std::lock_guard<std::mutex> lk(mtx_);
+						probe = planner_.probe_bps(now);
+						live = controller_.throughput_bps();
 					}
-
-					std::string bw = find_attr("BANDWIDTH=");
-					if (!bw.empty())
+					if (probe <= 0.0)
 					{
-						try { v.bandwidth = std::stoll(bw); }
-						catch (...) { v.bandwidth = 0; }
+						try { probe = probe_link(master_url, variants); }
+						catch (...) { probe = 0.0; }
+						std::lock_guard<std::mutex> lk(mtx_);
+						if (probe > 0.0) planner_.set_probe(now, probe);
 					}
 
-					std::string next_line;
-					while (std::getline(ss, next_line))
+					const double lecture_sec = a.contains("length") && a["length"].is_number() ? a["length"].get<double>() : 0.0;
+					double budget = 0.0;
 					{
-						if (!next_line.empty() && next_line.back() == '\r') next_line.pop_back();
-						std::string url_line = Helper::trim(next_line);
-						if (url_line.empty()) continue;
-						if (url_line.rfind("#", 0) == 0) continue;
-						v.uri = url_line;
-						break;
+						std::lock_guard<std::mutex> lk(mtx_);
+						budget = planner_.budget_bps(course_id, lecture_id, lecture_sec, now, std::max(probe, live));
 					}
-
-					if (!v.uri.empty()) variants.push_back(std::move(v));
+					const Variant* chosen = VariantPlanner::pick(variants, Helper::extract_quality_value(prefer_quality), budget);
+					if (!chosen) return {};
+					std::cout << "[HLS] deadline plan: " << static_cast<long long>(budget / 1000) << " kbps budget, picked "
+						<< chosen->height << "p @ " << chosen->bandwidth / 1000 << " kbps" << std::endl;
+					return make_absolute(master_url, chosen->uri);
 				}
 
-				if (variants.empty()) return {};
-
 				const Variant* exact = nullptr;
 				const Variant* best_height = nullptr;
 				const Variant* best_bandwidth = nullptr;
@@ -1793,125 +2824,1066 @@ std::string RequestHandler::resolve_supplementary_asset(int course_id, int lectu
 
 	throw std::runtime_error("no downloadable url in supplementary");
 }
+std::string RequestHandler::resolve_job_url(const Job& j) {
+	if (j.asset_id) return resolve_supplementary_asset(j.course_id, j.lecture_id, j.asset_id);
+	return resolve_lecture_stream(j.course_id, j.lecture_id, j.quality);
+}
 
-
-static inline double now_sec() {
-	using namespace std::chrono;
-	return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+void RequestHandler::set_job_url(Job& j, std::string url) const {
+	// auth headers depend on the host, so rebuild the defaults and keep the caller's extras
+	std::vector<std::string> headers = default_headers(url);
+	for (auto& h : j.headers) if (!is_default_header(h)) headers.push_back(h);
+	j.headers = std::move(headers);
+	j.url = std::move(url);
+	j.url_ts = now_sec();
 }
 
-void RequestHandler::worker_loop() {
-	while (true)
+void RequestHandler::resolver_loop() {
+	std::unique_lock<std::mutex> lk(mtx_);
+	while (!stop_)
 	{
-		Job j;
+		std::vector<Job> todo;
+		const double now = now_sec();
+		for (uint64_t id : scheduler_.peek(kPrefetchAhead))
+		{
+			Job* jp = find_job(id);
+			if (jp && url_is_stale(*jp, now, kPrefetchMarginSec)) todo.push_back(*jp);
+		}
 
+		if (todo.empty())
 		{
-			std::unique_lock<std::mutex> lk(mtx_);
-			cv_.wait(lk, [&] { return !queue_.empty() || stop_; });
-			if (stop_) break;
+			resolve_cv_.wait_for(lk, std::chrono::seconds(5));
+			continue;
+		}
 
-			auto it = std::find_if(queue_.begin(), queue_.end(),
-				[](const Job& x) { return x.state == Job::State::Queued; });
-			if (it == queue_.end())
+		lk.unlock();
+		bool failed = false;
+		for (auto& j : todo)
+		{
+			try
+			{
+				set_job_url(j, resolve_job_url(j));
+			}
+			catch (const std::exception&)
 			{
-				lk.unlock();
-				std::this_thread::sleep_for(std::chrono::milliseconds(200));
-				continue;
+				j.url_ts = -1.0;
+				failed = true;
 			}
-			j = *it;
-			it->state = Job::State::Downloading;
 		}
+		lk.lock();
 
-		std::string lower_url = j.url;
-		std::transform(lower_url.begin(), lower_url.end(), lower_url.begin(), [](unsigned char c) { return (char)std::tolower(c); });
-		bool is_hls = lower_url.find(".m3u8") != std::string::npos;
-
-		auto out_dir = std::filesystem::u8path(j.out_path_dir);
-		std::filesystem::path target_path = out_dir / std::filesystem::u8path(j.filename);
-		if (is_hls)
+		for (auto& r : todo)
 		{
-			target_path.replace_extension(".ts");
-			j.filename = Helper::path_to_utf8(target_path.filename());
-			std::cout << "[HLS] Downloading HLS stream to TS: " << Helper::path_to_utf8(target_path) << std::endl;
+			if (r.url_ts <= 0.0) continue;
+			Job* jp = find_job(r.id);
+			if (!jp || jp->state != Job::State::Queued) continue;
+			jp->url = std::move(r.url);
+			jp->headers = std::move(r.headers);
+			jp->url_ts = r.url_ts;
 		}
 
-		j.out_path = Helper::path_to_utf8(target_path);
+		// back off instead of hammering the API while it refuses
+		if (failed) resolve_cv_.wait_for(lk, std::chrono::seconds(5));
+	}
+}
 
-		std::atomic<double>     last_ts{ now_sec() };
-		std::atomic<long long>  last_bytes{ 0 };
 
-		auto on_progress = [this, &j, &last_ts, &last_bytes](double dlnow, double dltotal)
-			{
-				std::lock_guard<std::mutex> lk(mtx_);
 
-				j.bytes_now = static_cast<long long>(dlnow);
-				j.bytes_total = static_cast<long long>(dltotal);
+// ---------------- scheduling ----------------
+// caller holds mtx_
+RequestHandler::Job* RequestHandler::find_job(uint64_t id) {
+	return queue_.find(id);
+}
 
-				double ts = now_sec();
-				const double dt = std::max(0.25, ts - last_ts.load());
-				long long db = j.bytes_now - last_bytes.load();
-				double inst = (double)db / dt; // B/s
-				if (j.speed_bps <= 0) j.speed_bps = inst;
-				else                  j.speed_bps = 0.25 * inst + 0.75 * j.speed_bps;
+// caller holds mtx_
+void RequestHandler::make_ready(const Job& j) {
+	JobScheduler::Key k;
+	k.id = j.id;
+	k.course_id = j.course_id;
+	k.section_index = j.section_index;
+	k.lecture_index = j.lecture_index;
+	k.size = j.bytes_total > 0 ? j.bytes_total : -1;
+	k.priority = j.priority;
+	// a size learned later can move a job between lanes
+	if (is_small_job(j))
+	{
+		scheduler_.remove(j.id);
+		small_ready_.push(k);
+	}
+	else
+	{
+		small_ready_.remove(j.id);
+		scheduler_.push(k);
+	}
+}
 
-				last_ts.store(ts);
-				last_bytes.store(j.bytes_now);
+// caller holds mtx_
+void RequestHandler::unready(uint64_t id) {
+	scheduler_.remove(id);
+	small_ready_.remove(id);
+}
 
-				if (j.bytes_total > 0)
-					j.progress = (j.bytes_now * 100.0) / (double)j.bytes_total;
+// ---------------- queue journal ----------------
+std::vector<std::string> RequestHandler::default_headers(const std::string& url) const {
+	std::vector<std::string> h;
+	h.push_back(std::string("User-Agent: ") + kDefaultUserAgent);
+	h.push_back("Referer: https://www.udemy.com/");
+	h.push_back("Origin: https://www.udemy.com");
+	append_auth_headers_for_url(url, h);
+	return h;
+}
 
-				for (auto& q : queue_) if (q.id == j.id)
-				{
-					q.bytes_now = j.bytes_now;
-					q.bytes_total = j.bytes_total;
-					q.speed_bps = j.speed_bps;
-					q.progress = j.progress;
-					q.filename = j.filename;
-					q.out_path = j.out_path;
-					break;
-				}
-			};
+json RequestHandler::job_to_json(const Job& j) {
+	json o;
+	o["id"] = j.id;
+	o["url"] = j.url;
+	o["filename"] = j.filename;
+	json extra = json::array();
+	for (auto& h : j.headers) if (!is_default_header(h)) extra.push_back(h);
+	if (!extra.empty()) o["headers"] = std::move(extra);
+	o["course_id"] = j.course_id;
+	o["course_title"] = j.course_title;
+	o["out_dir"] = j.out_path_dir;
+	if (!j.out_path.empty()) o["out_path"] = j.out_path;
+	o["section_index"] = j.section_index;
+	o["section_title"] = j.section_title;
+	o["lecture_index"] = j.lecture_index;
+	o["lecture_title"] = j.lecture_title;
+	if (j.lecture_id) o["lecture_id"] = j.lecture_id;
+	if (j.asset_id) o["asset_id"] = j.asset_id;
+	if (!j.quality.empty()) o["quality"] = j.quality;
+	if (!j.container.empty()) o["container"] = j.container;
+	if (!j.captions.empty())
+	{
+		json caps = json::array();
+		for (auto& [lang, url] : j.captions) caps.push_back({ {"lang", lang}, {"url", url} });
+		o["captions"] = std::move(caps);
+	}
+	o["state"] = state_name(j.state);
+	if (j.url_refreshes) o["url_refreshes"] = j.url_refreshes;
+	if (j.reconnects) o["reconnects"] = j.reconnects;
+	if (j.attempts)
+	{
+		o["attempts"] = j.attempts;
+		o["class_attempts"] = j.class_attempts;
+	}
+	if (!j.error_class.empty()) o["error_class"] = j.error_class;
+	if (j.priority) o["priority"] = j.priority;
+	if (!j.message.empty()) o["msg"] = j.message;
+	if (j.bytes_total > 0) o["bytes_total"] = j.bytes_total;
+	return o;
+}
 
-		{
-			std::error_code ed;
-			std::filesystem::create_directories(out_dir, ed);
+RequestHandler::Job RequestHandler::job_from_json(const json& o) {
+	Job j;
+	j.id = o.value("id", 0ULL);
+	j.url = o.value("url", std::string{});
+	j.filename = o.value("filename", std::string{});
+	if (o.contains("headers") && o["headers"].is_array())
+		for (auto& h : o["headers"]) if (h.is_string()) j.headers.push_back(h.get<std::string>());
+	j.course_id = o.value("course_id", 0);
+	j.course_title = o.value("course_title", std::string{});
+	j.out_path_dir = o.value("out_dir", std::string{});
+	j.out_path = o.value("out_path", std::string{});
+	j.section_index = o.value("section_index", 0);
+	j.section_title = o.value("section_title", std::string{});
+	j.lecture_index = o.value("lecture_index", 0);
+	j.lecture_title = o.value("lecture_title", std::string{});
+	j.lecture_id = o.value("lecture_id", 0);
+	j.asset_id = o.value("asset_id", 0);
+	j.quality = o.value("quality", std::string{});
+	j.container = o.value("container", std::string{});
+	if (o.contains("captions") && o["captions"].is_array())
+		for (auto& c : o["captions"])
+			if (c.is_object()) j.captions.emplace_back(c.value("lang", std::string{}), c.value("url", std::string{}));
+	j.state = state_from_name(o.value("state", std::string{}));
+	j.url_refreshes = o.value("url_refreshes", 0);
+	j.reconnects = o.value("reconnects", 0);
+	j.attempts = o.value("attempts", 0);
+	read_class_attempts(o, j);
+	j.error_class = o.value("error_class", std::string{});
+	j.priority = o.value("priority", 0);
+	j.message = o.value("msg", std::string{});
+	j.bytes_total = o.value("bytes_total", 0LL);
+	return j;
+}
 
-			std::string msg = "";
-			bool ok = false;
-			if (is_hls)
-			{
-				ok = FFmpegHelper::convert_m3u8_to_ts(j.url, j.out_path, j.headers, proxy_, on_progress, msg);
-			}
-			else
-			{
-				ok = curl_download_file(j.url, j.out_path, j.headers, on_progress, msg);
-			}
+// caller holds mtx_
+void RequestHandler::journal_event(const json& rec) {
+	journal_.append(rec);
+	if (journal_.records() > std::max<size_t>(4096, queue_.size() * 4))
+		compact_journal();
+}
 
-			{
-				std::lock_guard<std::mutex> lk(mtx_);
-				for (auto& q : queue_) if (q.id == j.id)
-				{
-					q.filename = j.filename;
-					q.out_path = j.out_path;
-					if (ok)
+// caller holds mtx_
+void RequestHandler::journal_events(const std::vector<json>& recs) {
+	journal_.append(recs);
+	if (journal_.records() > std::max<size_t>(4096, queue_.size() * 4))
+		compact_journal();
+}
+
+// caller holds mtx_ (or runs before the worker starts)
+void RequestHandler::compact_journal() {
+	std::vector<json> snap;
+	snap.reserve(queue_.size() + progress_.size() + paused_courses_.size());
+	for (auto& j : queue_) snap.push_back({ {"ev", "add"}, {"job", job_to_json(j)} });
+	// course records come last so they override the totals counted from the adds
+	for (auto& [cid, cp] : progress_)
+		snap.push_back({ {"ev", "course"}, {"course_id", cid}, {"title", cp.title}, {"total", cp.total}, {"done", cp.done}, {"failed", cp.failed} });
+	for (int cid : paused_courses_) snap.push_back({ {"ev", "pause"}, {"course_id", cid} });
+	journal_.compact(snap);
+}
+
+// caller holds mtx_ (or runs before the worker starts)
+void RequestHandler::archive_job(uint64_t id, bool persist) {
+	Job* jp = queue_.find(id);
+	if (!jp) return;
+
+	json rec = job_to_json(*jp);
+	rec.erase("headers");
+	unready(id);
+
+	if (persist)
+	{
+		rec["finished_at"] = static_cast<long long>(std::time(nullptr));
+
+		std::error_code ec;
+		std::filesystem::create_directories(std::filesystem::u8path(kHistoryDir), ec);
+		std::string path = std::string(kHistoryDir) + "/" + std::to_string(jp->course_id) + ".jsonl";
+		std::string line = rec.dump() + "\n";
+		if (FILE* fp = Helper::xfopen(path.c_str(), "ab"))
+		{
+			fwrite(line.data(), 1, line.size(), fp);
+			fclose(fp);
+		}
+		journal_event({ {"ev", "archive"}, {"id", id} });
+	}
+
+	queue_.erase(id);
+	history_.push_back(std::move(rec));
+	if (history_.size() > kHistoryRing) history_.pop_front();
+}
+
+// caller holds mtx_; the .part is left on disk
+void RequestHandler::mark_cancelled(Job& q) {
+	q.state = Job::State::Cancelled;
+	q.message = "cancelled";
+	// a cancelled job no longer counts towards its course
+	if (q.course_id)
+	{
+		auto itp = progress_.find(q.course_id);
+		if (itp != progress_.end() && itp->second.total > 0) itp->second.total -= 1;
+	}
+}
+
+// caller holds mtx_; q is archived and gone afterwards
+void RequestHandler::finish_job(Job& q) {
+	const int course_id = q.course_id;
+	queue_.mark_finished(q);
+	journal_event({ {"ev", "state"}, {"id", q.id}, {"state", state_name(q.state)},
+					{"msg", q.message}, {"error_class", q.error_class},
+					{"filename", q.filename}, {"out_path", q.out_path} });
+	archive_job(q.id);
+	if (course_id) end_plan_if_idle(course_id);
+}
+
+void RequestHandler::recover_queue() {
+	auto t0 = std::chrono::steady_clock::now();
+	uint64_t max_id = 0;
+
+	journal_.replay([&](const json& rec)
+		{
+			const std::string ev = rec.value("ev", "");
+			if (ev == "add" && rec.contains("job"))
+			{
+				Job j = job_from_json(rec["job"]);
+				if (!j.id || queue_.find(j.id)) return;
+				max_id = std::max(max_id, j.id);
+				if (j.course_id)
+				{
+					auto& cp = progress_[j.course_id];
+					if (cp.title.empty()) cp.title = j.course_title;
+					if (j.state != Job::State::Cancelled) cp.total += 1;
+					if (j.state == Job::State::Done) cp.done += 1;
+					if (j.state == Job::State::Failed) cp.failed += 1;
+				}
+				queue_.insert(std::move(j));
+			}
+			else if (ev == "state")
+			{
+				Job* jp = find_job(rec.value("id", 0ULL));
+				if (!jp) return;
+				Job& j = *jp;
+				auto st = state_from_name(rec.value("state", ""));
+				if (st == Job::State::Done && j.state != Job::State::Done && j.course_id)
+					progress_[j.course_id].done += 1;
+				if (st == Job::State::Failed && j.state != Job::State::Failed && j.course_id)
+					progress_[j.course_id].failed += 1;
+				if (st == Job::State::Cancelled && j.state != Job::State::Cancelled && j.course_id && progress_[j.course_id].total > 0)
+					progress_[j.course_id].total -= 1;
+				j.state = st;
+				if (j.finished()) queue_.mark_finished(j);
+				else queue_.mark_active(j);
+				if (rec.contains("msg")) j.message = rec.value("msg", "");
+				if (rec.contains("attempts")) j.attempts = rec.value("attempts", 0);
+				read_class_attempts(rec, j);
+				if (rec.contains("error_class")) j.error_class = rec.value("error_class", "");
+				if (rec.contains("filename")) j.filename = rec.value("filename", j.filename);
+				if (rec.contains("out_path")) j.out_path = rec.value("out_path", j.out_path);
+			}
+			else if (ev == "priority")
+			{
+				if (Job* jp = find_job(rec.value("id", 0ULL))) jp->priority = rec.value("priority", 0);
+			}
+			else if (ev == "archive")
+			{
+				// already in history/<course_id>.jsonl
+				archive_job(rec.value("id", 0ULL), false);
+			}
+			else if (ev == "pause")
+			{
+				paused_courses_.insert(rec.value("course_id", 0));
+			}
+			else if (ev == "resume")
+			{
+				// course resume also releases jobs that were paused one by one
+				int cid = rec.value("course_id", 0);
+				paused_courses_.erase(cid);
+				for (uint64_t qid : queue_.course_jobs(cid))
+					if (Job* jp = find_job(qid); jp && jp->state == Job::State::Paused) jp->state = Job::State::Queued;
+			}
+			else if (ev == "course")
+			{
+				auto& cp = progress_[rec.value("course_id", 0)];
+				cp.title = rec.value("title", cp.title);
+				cp.total = rec.value("total", cp.total);
+				cp.done = rec.value("done", cp.done);
+				cp.failed = rec.value("failed", cp.failed);
+			}
+		});
+
+	// finished jobs that never reached the history (older journals, or a crash
+	// between the state and archive records)
+	std::vector<uint64_t> finished;
+	for (auto& j : queue_)
+		if (j.finished()) finished.push_back(j.id);
+	for (uint64_t id : finished) archive_job(id);
+
+	size_t live = 0, reattached = 0;
+	for (auto& j : queue_)
+	{
+		++live;
+
+		// interrupted transfers go back to the queue; pause state follows the course or the job
+		bool paused = j.state == Job::State::Paused || paused_courses_.count(j.course_id);
+		j.state = paused ? Job::State::Paused : Job::State::Queued;
+		if (j.state == Job::State::Queued) make_ready(j);
+
+		auto defaults = default_headers(j.url);
+		j.headers.insert(j.headers.begin(), defaults.begin(), defaults.end());
+
+		std::error_code ec;
+		auto part = std::filesystem::u8path(j.out_path.empty() ? j.out_path_dir + "/" + j.filename : j.out_path);
+		part += ".part";
+		auto sz = std::filesystem::file_size(part, ec);
+		auto segs = part;
+		segs.replace_extension(".segs");
+		if (!ec && sz > 0)
+		{
+			j.bytes_now = static_cast<long long>(sz);
+			if (j.bytes_total > 0) j.progress = (j.bytes_now * 100.0) / (double)j.bytes_total;
+			j.message = "resuming from .part";
+			++reattached;
+		}
+		else if (std::filesystem::is_directory(segs, ec))
+		{
+			j.message = "resuming from cached segments";
+			++reattached;
+		}
+	}
+
+	if (max_id >= next_id_) next_id_ = max_id + 1;
+	if (journal_.records() > 0) compact_journal();
+
+	if (live || !finished.empty())
+	{
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+		std::cout << "[queue] recovered " << live << " live jobs ("
+			<< reattached << " with .part, " << finished.size() << " archived) in " << ms << " ms\n";
+	}
+}
+
+// ---------------- checksums / verify ----------------
+void RequestHandler::record_checksum(const Job& j, const TransferContext& tc) {
+	if (tc.xxh64.empty()) return;
+
+	std::string root = (j.course_id && !j.course_title.empty())
+		? Helper::course_dir(j.course_id, j.course_title)
+		: j.out_path_dir;
+
+	std::error_code ec;
+	auto file_path = std::filesystem::u8path(j.out_path);
+	auto rel = file_path.lexically_relative(std::filesystem::u8path(root));
+	if (rel.empty()) rel = file_path.filename();
+
+	json line;
+	line["file"] = Helper::path_to_utf8(rel.generic_u8string());
+	line["size"] = static_cast<long long>(std::filesystem::file_size(file_path, ec));
+	line["xxh64"] = tc.xxh64;
+	if (!tc.sha256.empty()) line["sha256"] = tc.sha256;
+	line["ts"] = static_cast<long long>(std::time(nullptr));
+
+	std::string manifest = root + "/" + kManifestName;
+	std::string text = line.dump() + "\n";
+
+	std::lock_guard<std::mutex> lk(manifest_mtx_);
+	FILE* fp = Helper::xfopen(manifest.c_str(), "ab");
+	if (!fp) return;
+	fwrite(text.data(), 1, text.size(), fp);
+	fclose(fp);
+}
+
+std::string RequestHandler::find_course_dir(int course_id) {
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		auto it = progress_.find(course_id);
+		if (it != progress_.end() && !it->second.title.empty())
+			return Helper::course_dir(course_id, it->second.title);
+	}
+
+	// not queued in this session: look for downloads/<slug>-<id>
+	const std::string suffix = "-" + std::to_string(course_id);
+	std::error_code ec;
+	for (auto& e : std::filesystem::directory_iterator(std::filesystem::u8path("downloads"), ec))
+	{
+		if (!e.is_directory()) continue;
+		std::string name = Helper::path_to_utf8(e.path().filename());
+		if (name.size() > suffix.size() &&
+			name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+		{
+			return "downloads/" + name;
+		}
+	}
+	return {};
+}
+
+void RequestHandler::monitor_loop() {
+	std::unordered_map<uint64_t, long long> last_bytes;
+	double last = now_sec();
+
+	std::unique_lock<std::mutex> lk(mtx_);
+	while (!stop_)
+	{
+		monitor_cv_.wait_for(lk, std::chrono::seconds(1));
+		if (stop_) break;
+
+		const double now = now_sec();
+		const double dt = now - last;
+		last = now;
+
+		// bytes moved since the previous tick; a transfer's first tick only sets its baseline
+		long long moved = 0;
+		std::unordered_map<uint64_t, long long> seen;
+		for (uint64_t id : running_)
+		{
+			Job* jp = find_job(id);
+			if (!jp || !jp->slot) continue;
+			long long b = jp->slot->bytes_now.load(std::memory_order_relaxed);
+			auto it = last_bytes.find(id);
+			if (it != last_bytes.end() && b >= it->second) moved += b - it->second;
+			seen[id] = b;
+		}
+		last_bytes.swap(seen);
+
+		int before = controller_.limit();
+		bool wake = controller_.sample(now, moved, dt, static_cast<int>(running_.size() - small_active_)) && controller_.limit() > before;
+
+		while (!retry_due_.empty() && retry_due_.begin()->first <= now)
+		{
+			uint64_t id = retry_due_.begin()->second;
+			retry_due_.erase(retry_due_.begin());
+			Job* jp = find_job(id);
+			if (!jp || jp->state != Job::State::Retrying) continue;
+			jp->state = paused_courses_.count(jp->course_id) ? Job::State::Paused : Job::State::Queued;
+			if (jp->state == Job::State::Queued) make_ready(*jp);
+			wake = true;
+		}
+		if (wake) cv_.notify_all();
+
+		while (workers_.size() < static_cast<size_t>(controller_.limit()))
+			workers_.emplace_back([this] { worker_loop(); });
+	}
+}
+
+std::pair<boost::beast::http::status, std::string> RequestHandler::handleMetrics() {
+	json out;
+	out["ok"] = true;
+
+	std::lock_guard<std::mutex> lk(mtx_);
+	const double now = now_sec();
+
+	json c;
+	c["limit"] = controller_.limit();
+	c["max"] = controller_.max_limit();
+	c["active"] = running_.size();
+	c["workers"] = workers_.size();
+	c["segments_per_file"] = controller_.segments_per_file();
+	c["throughput_bps"] = controller_.throughput_bps();
+	c["ready"] = scheduler_.size();
+	c["ready_small"] = small_ready_.size();
+	c["active_small"] = small_active_;
+
+	json decisions = json::array();
+	for (auto& d : controller_.decisions())
+	{
+		decisions.push_back({ {"age_sec", now - d.ts}, {"limit", d.limit}, {"bps", d.bps},
+							  {"per_transfer_bps", d.per_transfer}, {"reason", d.reason} });
+	}
+	c["decisions"] = std::move(decisions);
+	out["concurrency"] = std::move(c);
+
+	// totals; divide by "transfers" for the per-lecture profile
+	json h = stages_to_json(hls_stages_);
+	h["transfers"] = hls_timed_;
+	out["hls_stages"] = std::move(h);
+
+	return { boost::beast::http::status::ok, out.dump() };
+}
+
+std::pair<boost::beast::http::status, std::string> RequestHandler::handleVerify(const std::string& target) {
+	using status = boost::beast::http::status;
+	auto get_param = [&](const char* key)->std::string
+		{
+			auto qpos = target.find('?'); if (qpos == std::string::npos) return {};
+			std::string qs = target.substr(qpos + 1);
+			std::istringstream ss(qs); std::string kv;
+			while (std::getline(ss, kv, '&'))
+			{
+				auto eq = kv.find('='); if (eq == std::string::npos) continue;
+				auto k = kv.substr(0, eq), v = kv.substr(eq + 1);
+				if (k == key) return v;
+			}
+			return {};
+		};
+	auto run_to_json = [](const VerifyRun& r)
+		{
+			json o = r.state == "done" ? r.result : json::object();
+			o["ok"] = true;
+			o["id"] = r.id;
+			o["course_id"] = r.course_id;
+			o["dir"] = r.dir;
+			o["state"] = r.state;
+			if (!r.error.empty()) o["error"] = r.error;
+			return o;
+		};
+
+	json out; out["ok"] = true;
+
+	// polling a check started earlier
+	if (!get_param("id").empty())
+	{
+		uint64_t id = 0;
+		try { id = std::stoull(get_param("id")); }
+		catch (...) {}
+		std::lock_guard<std::mutex> lk(mtx_);
+		auto it = verifies_.find(id);
+		if (it == verifies_.end()) { out["ok"] = false; out["error"] = "unknown verify id"; return { status::not_found, out.dump() }; }
+		return { status::ok, run_to_json(it->second).dump() };
+	}
+
+	int course_id = 0;
+	try { course_id = std::stoi(get_param("course_id")); }
+	catch (...) {}
+	const bool deep = get_param("deep") == "1"; // also compare sha256 when recorded
+
+	if (!course_id) { out["ok"] = false; out["error"] = "missing course_id"; return { status::bad_request, out.dump() }; }
+
+	std::string dir = find_course_dir(course_id);
+	if (dir.empty()) { out["ok"] = false; out["error"] = "course_dir not found"; return { status::not_found, out.dump() }; }
+
+	// more threads than cores only add seeks
+	const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	unsigned threads = cores;
+	{
+		std::string ts = get_param("threads");
+		if (!ts.empty()) try { threads = static_cast<unsigned>(std::clamp(std::stoi(ts), 1, static_cast<int>(cores))); }
+		catch (...) {}
+	}
+
+	uint64_t id = 0;
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		for (auto& [rid, r] : verifies_)
+		{
+			if (r.course_id == course_id && r.deep == deep && (r.state == "pending" || r.state == "running"))
+				return { status::accepted, run_to_json(r).dump() };
+		}
+
+		// keep the newest finished results for polling
+		size_t finished = 0;
+		for (auto& [rid, r] : verifies_) if (r.state == "done" || r.state == "failed") ++finished;
+		for (auto it = verifies_.begin(); it != verifies_.end() && finished >= kVerifyRunsKept;)
+		{
+			if (it->second.state == "done" || it->second.state == "failed") { it = verifies_.erase(it); --finished; }
+			else ++it;
+		}
+
+		VerifyRun r;
+		r.id = id = next_verify_id_++;
+		r.course_id = course_id;
+		r.dir = dir;
+		r.deep = deep;
+		r.threads = threads;
+		out = run_to_json(r);
+		verifies_[id] = std::move(r);
+		verify_pending_.push_back(id);
+	}
+	verify_cv_.notify_one();
+	return { status::accepted, out.dump() };
+}
+
+void RequestHandler::verifier_loop() {
+	while (true)
+	{
+		uint64_t id = 0;
+		{
+			std::unique_lock<std::mutex> lk(mtx_);
+			verify_cv_.wait(lk, [&] { return !verify_pending_.empty() || stop_; });
+			if (stop_) break;
+			id = verify_pending_.front();
+			verify_pending_.pop_front();
+		}
+		run_verify(id);
+	}
+}
+
+// Runs on verifier_: re-hashes every file of the manifest on up to
+// run.threads threads and leaves the counts in the run for GET /verify?id=.
+void RequestHandler::run_verify(uint64_t id) {
+	VerifyRun run;
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		auto it = verifies_.find(id);
+		if (it == verifies_.end()) return;
+		it->second.state = "running";
+		run = it->second;
+	}
+
+	// last line wins: a re-downloaded file appends a fresh entry
+	std::map<std::string, json> entries;
+	{
+		std::string text = Helper::read_file_utf8(run.dir + "/" + kManifestName);
+		std::istringstream is(text);
+		std::string line;
+		while (std::getline(is, line))
+		{
+			if (line.empty()) continue;
+			try
+			{
+				json e = json::parse(line);
+				std::string file = e.value("file", "");
+				if (!file.empty()) entries[file] = std::move(e);
+			}
+			catch (...) {}
+		}
+	}
+
+	struct Check {
+		std::string file;
+		json expected;
+		std::string result; // ok | missing | size_mismatch | hash_mismatch | error
+		long long bytes = 0;
+	};
+	std::vector<Check> checks;
+	checks.reserve(entries.size());
+	for (auto& [file, e] : entries) checks.push_back({ file, e, {}, 0 });
+
+	const unsigned threads = std::min<unsigned>(run.threads, static_cast<unsigned>(std::max<size_t>(1, checks.size())));
+
+	auto t0 = std::chrono::steady_clock::now();
+	std::atomic<size_t> next{ 0 };
+	std::atomic<bool> stopped{ false };
+	auto work = [&]()
+		{
+			for (size_t i = next++; i < checks.size(); i = next++)
+			{
+				{
+					std::lock_guard<std::mutex> lk(mtx_);
+					if (stop_) { stopped = true; return; }
+				}
+				auto& c = checks[i];
+				auto path = std::filesystem::u8path(run.dir) / std::filesystem::u8path(c.file);
+				std::error_code ec;
+				auto size = std::filesystem::file_size(path, ec);
+				if (ec) { c.result = "missing"; continue; }
+				if (static_cast<long long>(size) != c.expected.value("size", -1LL)) { c.result = "size_mismatch"; continue; }
+
+				const bool want_sha = run.deep && c.expected.contains("sha256");
+				std::string xxh, sha, err;
+				if (!Checksum::hash_file(Helper::path_to_utf8(path), want_sha, xxh, sha, err)) { c.result = "error"; continue; }
+				c.bytes = static_cast<long long>(size);
+
+				bool match = xxh == c.expected.value("xxh64", "");
+				if (match && want_sha) match = sha == c.expected.value("sha256", "");
+				c.result = match ? "ok" : "hash_mismatch";
+			}
+		};
+
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work);
+	work();
+	for (auto& t : pool) t.join();
+
+	auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+
+	json out;
+	int good = 0;
+	long long bytes = 0;
+	out["bad"] = json::array();
+	for (auto& c : checks)
+	{
+		bytes += c.bytes;
+		if (c.result == "ok") { ++good; continue; }
+		out["bad"].push_back({ {"file", c.file}, {"result", c.result} });
+	}
+	out["checked"] = checks.size();
+	out["good"] = good;
+	out["bytes"] = bytes;
+	out["threads"] = threads;
+	out["elapsed_ms"] = elapsed_ms;
+
+	std::lock_guard<std::mutex> lk(mtx_);
+	auto it = verifies_.find(id);
+	if (it == verifies_.end()) return;
+	if (stopped)
+	{
+		it->second.state = "failed";
+		it->second.error = "server stopping";
+		return;
+	}
+	it->second.state = "done";
+	it->second.result = std::move(out);
+}
+
+std::pair<boost::beast::http::status, std::string> RequestHandler::handleHistory(const std::string& target) {
+	using status = boost::beast::http::status;
+	auto get_param = [&](const char* key)->std::string
+		{
+			auto qpos = target.find('?'); if (qpos == std::string::npos) return {};
+			std::string qs = target.substr(qpos + 1);
+			std::istringstream ss(qs); std::string kv;
+			while (std::getline(ss, kv, '&'))
+			{
+				auto eq = kv.find('='); if (eq == std::string::npos) continue;
+				auto k = kv.substr(0, eq), v = kv.substr(eq + 1);
+				if (k == key) return v;
+			}
+			return {};
+		};
+
+	int course_id = 0, page = 0;
+	try { course_id = std::stoi(get_param("course_id")); }
+	catch (...) {}
+	try { page = std::max(0, std::stoi(get_param("page"))); }
+	catch (...) {}
+
+	const size_t first = static_cast<size_t>(page) * kHistoryPageSize;
+	json items = json::array();
+	size_t total = 0;
+
+	if (course_id)
+	{
+		// whole course history lives on disk; newest entries are at the end
+		std::string text = Helper::read_file_utf8(std::string(kHistoryDir) + "/" + std::to_string(course_id) + ".jsonl");
+		std::vector<std::pair<size_t, size_t>> lines;
+		for (size_t pos = 0; pos < text.size();)
+		{
+			size_t nl = text.find('\n', pos);
+			size_t end = nl == std::string::npos ? text.size() : nl;
+			if (end > pos) lines.emplace_back(pos, end);
+			pos = end + 1;
+		}
+
+		total = lines.size();
+		for (size_t i = first; i < total && items.size() < kHistoryPageSize; ++i)
+		{
+			auto [b, e] = lines[total - 1 - i];
+			auto rec = json::parse(text.data() + b, text.data() + e, nullptr, false);
+			if (!rec.is_discarded()) items.push_back(std::move(rec));
+		}
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		total = history_.size();
+		for (size_t i = first; i < total && items.size() < kHistoryPageSize; ++i)
+			items.push_back(history_[total - 1 - i]);
+	}
+
+	json out;
+	out["ok"] = true;
+	out["course_id"] = course_id;
+	out["page"] = page;
+	out["page_size"] = kHistoryPageSize;
+	out["total"] = total;
+	out["pages"] = (total + kHistoryPageSize - 1) / kHistoryPageSize;
+	out["items"] = std::move(items);
+	return { status::ok, out.dump() };
+}
+
+void RequestHandler::worker_loop(bool small_lane) {
+	CurlHandle lane_handle(small_lane);  // fast lane: one handle per worker, kept warm across jobs
+	while (true)
+	{
+		Job j;
+		int segments = 1;
+		std::string container;
+
+		{
+			std::unique_lock<std::mutex> lk(mtx_);
+			// woken by add/resume; paused-only queues just sleep here
+			// ...and held back while the controller's limit is used up
+			// the fast lane has its own fixed pool and stays outside the controller's limit
+			cv_.wait(lk, [&]
+				{
+					if (stop_) return true;
+					if (small_lane) return !small_ready_.empty();
+					return !scheduler_.empty() && running_.size() - small_active_ < static_cast<size_t>(controller_.limit());
+				});
+			if (stop_) break;
+
+			Job* next = find_job(small_lane ? small_ready_.pop() : scheduler_.pop());
+			if (!next || next->state != Job::State::Queued) continue;
+			next->state = Job::State::Downloading;
+			running_.insert(next->id);
+			if (small_lane) ++small_active_;
+			next->slot = std::make_shared<ProgressSlot>();
+			next->sample_ts = 0.0;
+			next->speed_bps = 0.0;
+			next->media_rate = 0.0;
+			segments = controller_.segments_per_file();
+			container = next->container.empty() ? hls_container_ : next->container;
+			j = *next;
+			journal_event({ {"ev", "state"}, {"id", j.id}, {"state", "downloading"} });
+		}
+		resolve_cv_.notify_one();
+
+		// usually pre-signed by resolver_; only a long wait since then costs a round trip here
+		std::string resolve_err;
+		if (url_is_stale(j, now_sec()))
+		{
+			try
+			{
+				set_job_url(j, resolve_job_url(j));
+			}
+			catch (const std::exception& e)
+			{
+				resolve_err = e.what();
+				std::cout << "[queue] url refresh failed for job " << j.id << ": " << resolve_err << "\n";
+			}
+		}
+
+		std::string lower_url = j.url;
+		std::transform(lower_url.begin(), lower_url.end(), lower_url.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		bool is_hls = lower_url.find(".m3u8") != std::string::npos;
+
+		auto out_dir = std::filesystem::u8path(j.out_path_dir);
+		std::filesystem::path target_path = out_dir / std::filesystem::u8path(j.filename);
+		if (is_hls)
+		{
+			target_path.replace_extension(FFmpegHelper::container_extension(container));
+			j.filename = Helper::path_to_utf8(target_path.filename());
+			std::cout << "[HLS] Downloading HLS stream (" << container << "): " << Helper::path_to_utf8(target_path) << std::endl;
+		}
+
+		j.out_path = Helper::path_to_utf8(target_path);
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			if (Job* qp = find_job(j.id))
+			{
+				qp->url = j.url;
+				qp->headers = j.headers;
+				qp->url_ts = j.url_ts;
+				qp->filename = j.filename;
+				qp->out_path = j.out_path;
+			}
+		}
+
+		// hot path: called for every XFERINFO tick / packet batch, so no lock and no lookup
+		auto on_progress = [slot = j.slot](double dlnow, double dltotal)
+			{
+				slot->bytes_now.store(static_cast<long long>(dlnow), std::memory_order_relaxed);
+				slot->bytes_total.store(static_cast<long long>(dltotal), std::memory_order_relaxed);
+			};
+
+		{
+			std::error_code ed;
+			std::filesystem::create_directories(out_dir, ed);
+
+			std::string msg = "";
+			bool ok = false;
+			TransferContext tc;
+			tc.want_sha256 = checksum_sha256_;
+			tc.control = &j.slot->control;
+			tc.small_lane = small_lane;
+			tc.easy = lane_handle.h;
+			tc.hls_segments = segments;
+			tc.container = container;
+			tc.captions = j.captions;
+			tc.probe_cache = &probe_cache_;
+			if (j.course_id && !j.quality.empty()) tc.probe_key = std::to_string(j.course_id) + "/" + j.quality;
+			tc.on_media_progress = [slot = j.slot](double now, double total)
+				{
+					slot->media_ms_now.store(std::llround(now * 1000.0), std::memory_order_relaxed);
+					slot->media_ms_total.store(std::llround(total * 1000.0), std::memory_order_relaxed);
+				};
+			tc.on_stages = [slot = j.slot](const HlsStages& s) { slot->store_stages(s); };
+			if (j.url.empty())
+			{
+				msg = "url: " + resolve_err;
+			}
+			else if (is_hls)
+			{
+				ok = FFmpegHelper::convert_m3u8_to_ts(j.url, j.out_path, j.headers, proxy_, on_progress, msg, &tc);
+			}
+			else
+			{
+				ok = curl_download_file(j.url, j.out_path, j.headers, on_progress, msg, &tc);
+			}
+
+			// expired signature: re-sign and pick up from the .part (HLS restarts the stream)
+			for (int refresh = 0; !ok && tc.url_rejected() && can_resolve(j) && refresh < kMaxUrlRefreshes; ++refresh)
+			{
+				try
+				{
+					set_job_url(j, resolve_job_url(j));
+				}
+				catch (const std::exception& e)
+				{
+					msg += " (url refresh failed: " + std::string(e.what()) + ")";
+					break;
+				}
+
+				j.url_refreshes += 1;
+				{
+					std::lock_guard<std::mutex> lk(mtx_);
+					if (Job* qp = find_job(j.id))
+					{
+						qp->url = j.url;
+						qp->headers = j.headers;
+						qp->url_ts = j.url_ts;
+						qp->url_refreshes = j.url_refreshes;
+						qp->message = "url refreshed, resuming";
+					}
+				}
+				std::cout << "[queue] job " << j.id << " got http " << tc.http_status << ", resuming with a fresh url\n";
+
+				tc.http_status = 0;
+				if (is_hls)
+					ok = FFmpegHelper::convert_m3u8_to_ts(j.url, j.out_path, j.headers, proxy_, on_progress, msg, &tc);
+				else
+					ok = curl_download_file(j.url, j.out_path, j.headers, on_progress, msg, &tc);
+			}
+
+			if (ok) record_checksum(j, tc);
+
+			{
+				std::lock_guard<std::mutex> lk(mtx_);
+				running_.erase(j.id);
+				if (small_lane) --small_active_;
+				auto stop = ok ? TransferControl::Run : static_cast<TransferControl>(j.slot->control.load(std::memory_order_relaxed));
+				if (!ok && (tc.http_status == 429 || tc.http_status >= 500)) controller_.on_congestion();
+				if (Job* qp = find_job(j.id))
+				{
+					Job& q = *qp;
+					q.filename = j.filename;
+					q.out_path = j.out_path;
+					q.bytes_now = j.slot->bytes_now.load(std::memory_order_relaxed);
+					q.bytes_total = j.slot->bytes_total.load(std::memory_order_relaxed);
+					q.media_now = j.slot->media_ms_now.load(std::memory_order_relaxed) / 1000.0;
+					q.media_total = j.slot->media_ms_total.load(std::memory_order_relaxed) / 1000.0;
+					q.speed_bps = 0.0;
+					q.media_rate = 0.0;
+					q.reconnects = tc.reconnects;
+					q.net_bytes += tc.net_bytes;
+					if (is_hls && tc.stages.total_ms > 0.0)
+					{
+						q.stages = tc.stages;
+						hls_stages_.add(tc.stages);
+						hls_timed_ += 1;
+					}
+					q.slot.reset();
+					if (ok)
 					{
 						q.state = Job::State::Done;
 						q.message = "ok";
+						if (!tc.captions_skipped.empty())
+						{
+							q.message += ", captions not embedded:";
+							for (auto& lang : tc.captions_skipped) q.message += " " + lang;
+						}
 						q.progress = 100.0;
+						q.error_class.clear();
 						if (q.course_id)
 						{
 							auto itp = progress_.find(q.course_id);
 							if (itp != progress_.end()) itp->second.done += 1;
 						}
 					}
+					else if (stop == TransferControl::Cancel)
+					{
+						mark_cancelled(q);
+						// FFmpegHelper already dropped an HLS job's .part and .segs
+						std::error_code ec;
+						std::filesystem::remove(std::filesystem::u8path(j.out_path + ".part"), ec);
+					}
+					else if (stop == TransferControl::Pause)
+					{
+						q.state = Job::State::Paused;
+						q.message = "paused";
+						journal_event({ {"ev", "state"}, {"id", q.id}, {"state", "paused"},
+										{"filename", q.filename}, {"out_path", q.out_path} });
+					}
 					else
 					{
-						q.state = Job::State::Failed;
-						q.message = msg.empty() ? "failed" : msg;
+						// a failed re-sign is retried like a network error; the budget still bounds it
+						auto cls = j.url.empty() ? RetryPolicy::Class::Network : RetryPolicy::classify(tc);
+						q.error_class = RetryPolicy::class_name(cls);
+						if (msg.empty()) msg = "failed";
+
+						int& tries = q.class_attempts[static_cast<size_t>(cls)];
+						if (tries < RetryPolicy::budget(cls))
+						{
+							// back to the scheduler later; the .part stays and the next run resumes it
+							tries += 1;
+							q.attempts += 1;
+							double wait = retry_.delay(cls, tries, tc.retry_after);
+							q.state = Job::State::Retrying;
+							q.retry_at = now_sec() + wait;
+							if (cls == RetryPolicy::Class::Auth) q.url_ts = 0.0;  // re-sign at dispatch
+							q.message = "retry " + std::to_string(tries) + "/" + std::to_string(RetryPolicy::budget(cls)) +
+								" in " + std::to_string(static_cast<long>(wait)) + "s: " + msg;
+							retry_due_.emplace(q.retry_at, q.id);
+							std::cout << "[queue] job " << q.id << " failed (" << q.error_class << "), " << q.message << "\n";
+							journal_event({ {"ev", "state"}, {"id", q.id}, {"state", state_name(q.state)},
+											{"msg", q.message}, {"attempts", q.attempts}, {"class_attempts", q.class_attempts}, {"error_class", q.error_class},
+											{"filename", q.filename}, {"out_path", q.out_path} });
+						}
+						else
+						{
+							q.state = Job::State::Failed;
+							q.message = msg;
+							if (q.course_id)
+							{
+								auto itp = progress_.find(q.course_id);
+								if (itp != progress_.end()) itp->second.failed += 1;
+							}
+						}
 					}
-					break;
+					if (q.finished()) finish_job(q);
 				}
 			}
+			cv_.notify_all();
 		}
 	}
 }
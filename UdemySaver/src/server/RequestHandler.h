@@ -11,6 +11,26 @@
 #include <unordered_set>
 #include <condition_variable>
 
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+
+#include "ConcurrencyController.h"
+#include "Job.h"
+#include "JobScheduler.h"
+#include "JobStore.h"
+#include "ProbeCache.h"
+#include "QueueJournal.h"
+#include "RetryPolicy.h"
+#include "VariantPlanner.h"
+
+struct TransferContext;
+struct CurlShare;
+
 struct HeaderProbe {
 	long long content_length = -1;       // Content-Length
 	long long content_range_total = -1;  // Content-Range: */TOTAL
@@ -22,35 +42,40 @@ public:
 		std::string title;
 		int total = 0; 
 		int done = 0; 
+		int failed = 0;
 	};
 
-	struct Job {
-		uint64_t id = 0;
-		std::string url;
-		std::string filename;
-		std::vector<std::string> headers;
-
-		int  course_id = 0;
-		std::string course_title;
-		std::string out_path_dir;
-		std::string out_path;
-
-		int section_index = 0;
-		std::string section_title;
-		int lecture_index = 0;
-		std::string lecture_title;
-
-		enum class State { Queued, Downloading, Done, Failed, Paused };
-		State state = State::Queued;
-
-		double progress = 0.0;
-		std::string message;
+	// server-side curriculum walk started by POST /course/download
+	struct CourseFeed {
+		int course_id = 0;
+		std::string title;
+		std::string quality = "720";
+		bool subs = true;
+		bool assets = true;
+		double deadline_min = 0.0;     // whole course, 0 = none (see VariantPlanner)
+		std::string state = "pending"; // pending, running, done, failed
+		int total = 0;     // curriculum items reported by the API
+		int lectures = 0;  // lectures walked so far
+		int queued = 0;
+		int skipped = 0;
+		std::string error;
+	};
 
-		long long bytes_now = 0;
-		long long bytes_total = 0;
-		double    speed_bps = 0.0;
+	// manifest check started by GET /verify, run on verifier_
+	struct VerifyRun {
+		uint64_t id = 0;
+		int course_id = 0;
+		std::string dir;
+		bool deep = false;
+		unsigned threads = 1;
+		std::string state = "pending"; // pending, running, done, failed
+		nlohmann::json result;         // counts and bad files once done
+		std::string error;
 	};
 
+	using ProgressSlot = ::ProgressSlot;
+	using Job = ::Job;
+
 	explicit RequestHandler(std::string webroot);
 	~RequestHandler();
 
@@ -72,16 +97,39 @@ public:
 
 	std::pair<boost::beast::http::status, std::string> handleQueueAdd(const std::string& body);
 
+	// POST /queue/batch [spec, ...] or {items:[...]} -> per-item results, one lock and one journal write
+	std::pair<boost::beast::http::status, std::string> handleQueueBatch(const std::string& body);
+
 	std::pair<boost::beast::http::status, std::string> handleQueueList();
 
+	// POST /course/download {course_id, course_title?, quality, subs, assets}
+	std::pair<boost::beast::http::status, std::string> handleCourseDownload(const std::string& body);
+
+	// POST /queue/pause, /queue/resume, /queue/cancel {id|course_id}; running
+	// transfers stop within a progress tick and keep their .part
 	std::pair<boost::beast::http::status, std::string> handleQueuePause(const std::string& body);
 
 	std::pair<boost::beast::http::status, std::string> handleQueueResume(const std::string& body);
 
+	std::pair<boost::beast::http::status, std::string> handleQueueCancel(const std::string& body);
+
+	// POST /queue/priority {id|course_id, priority}
+	std::pair<boost::beast::http::status, std::string> handleQueuePriority(const std::string& body);
+
 	std::pair<boost::beast::http::status, std::string> handleReconcile(const std::string& target);
 
 	std::pair<boost::beast::http::status, std::string> handleEstimate(const std::string& target);
 
+	// GET /verify?course_id=&deep=&threads= -> starts re-hashing the files listed in the
+	// course manifest and returns its id; GET /verify?id= -> state, then the result
+	std::pair<boost::beast::http::status, std::string> handleVerify(const std::string& target);
+
+	// GET /metrics -> concurrency controller state and recent decisions
+	std::pair<boost::beast::http::status, std::string> handleMetrics();
+
+	// GET /history?course_id=&page= -> finished jobs, newest first
+	std::pair<boost::beast::http::status, std::string> handleHistory(const std::string& target);
+
 	static size_t header_probe_cb(char* buffer, size_t size, size_t nitems, void* userdata);
 	bool probe_content_length(const std::string& url,
 							  const std::vector<std::string>& headers,
@@ -93,7 +141,8 @@ public:
 							const std::string& out_path,
 							const std::vector<std::string>& extra_headers,
 							std::function<void(double, double)> on_progress,
-							std::string& msg);
+							std::string& msg,
+							TransferContext* ctx = nullptr);
 
 	void append_auth_headers_for_url(const std::string& url, std::vector<std::string>& headers) const;
 private:
@@ -111,7 +160,53 @@ private:
 
 	std::string resolve_supplementary_asset(int course_id, int lecture_id, int asset_id);
 
-	void worker_loop();
+	// small_lane workers only take small items (captions, documents) from small_ready_
+	void worker_loop(bool small_lane = false);
+	// samples throughput once a second, applies the controller's limit and
+	// puts Retrying jobs whose backoff ran out back in the ready set
+	void monitor_loop();
+
+	// course feeder: pages the curriculum and enqueues each page as it arrives
+	void feeder_loop();
+	void feed_course(int course_id);
+	// drops the course's deadline plan once its feed is over and no job is left
+	void end_plan_if_idle(int course_id);
+	std::string curriculum_url(int course_id, int page, int page_size) const;
+	std::string fetch_course_title(int course_id);
+
+	// manifest checks, one at a time off the HTTP thread
+	void verifier_loop();
+	void run_verify(uint64_t id);
+
+	// just-in-time urls: jobs keep lecture/asset identity and get a freshly
+	// signed url at dispatch; resolver_ pre-signs the next few ready jobs
+	void resolver_loop();
+	std::string resolve_job_url(const Job& j);
+	void set_job_url(Job& j, std::string url) const;
+
+	Job* find_job(uint64_t id);
+	// validated job from a /queue spec (id not assigned yet); throws on bad input
+	Job job_from_spec(const nlohmann::json& in);
+	nlohmann::json enqueue_locked(Job j, std::vector<nlohmann::json>& journal);
+	void make_ready(const Job& j);
+	void unready(uint64_t id);
+
+	// persistent queue (queue.journal)
+	void recover_queue();
+	void journal_event(const nlohmann::json& rec);
+	void journal_events(const std::vector<nlohmann::json>& recs);
+	void compact_journal();
+	// moves a finished job out of queue_ into history_ (and history/<course_id>.jsonl)
+	void archive_job(uint64_t id, bool persist = true);
+	void finish_job(Job& q);
+	void mark_cancelled(Job& q);
+	static nlohmann::json job_to_json(const Job& j);
+	static Job job_from_json(const nlohmann::json& o);
+	std::vector<std::string> default_headers(const std::string& url) const;
+
+	// appends the file's digests to <course_dir>/.checksums.jsonl
+	void record_checksum(const Job& j, const TransferContext& tc);
+	std::string find_course_dir(int course_id);
 
 private:
 	std::string webroot_;
@@ -121,16 +216,49 @@ private:
 	std::string proxy_;     // settings: http_proxy (optional)
 	bool download_subtitles_ = true; // settings: download_subtitles
 	bool download_assets_ = true; // settings: download_assets
+	bool checksum_sha256_ = false; // settings: checksum_sha256
+	int max_parallel_ = 4; // settings: max_parallel (upper bound for the concurrency controller)
+	std::string hls_container_ = "ts"; // settings: hls_container (ts|mp4|fmp4)
+	bool embed_captions_ = false; // settings: embed_captions (mux captions into mp4 HLS lectures)
 
 	// queue
 	std::mutex mtx_;
 	std::condition_variable cv_;
-	std::vector<Job> queue_;
+	JobStore queue_;
+	JobScheduler scheduler_;
+	JobScheduler small_ready_;            // fast lane: captions and other small files
+	std::vector<std::thread> small_workers_;
+	size_t small_active_ = 0;             // running_ entries that belong to the fast lane
+	std::unique_ptr<CurlShare> share_;    // DNS and TLS sessions of the fast lane
 	std::atomic<uint64_t> next_id_{ 1 };
-	std::thread worker_;
+	std::vector<std::thread> workers_;   // grown by monitor_ up to the controller's limit
+	std::thread monitor_;
+	std::condition_variable monitor_cv_;
+	ConcurrencyController controller_{ 1, 4 };
+	std::unordered_set<uint64_t> running_;  // ids of Downloading jobs
+	RetryPolicy retry_;
+	VariantPlanner planner_;              // courses queued with a deadline
+	HlsStages hls_stages_;                // summed over finished HLS transfers, for /metrics
+	int hls_timed_ = 0;
+	ProbeCache probe_cache_;              // HLS stream parameters per course and quality, own lock
+	std::set<std::pair<double, uint64_t>> retry_due_;  // (retry_at, id) of Retrying jobs, released by monitor_
+	std::thread feeder_;
+	std::thread resolver_;
+	std::condition_variable resolve_cv_;
+	std::condition_variable feed_cv_;
+	std::deque<int> feed_pending_;                    // course ids waiting for the feeder
+	std::unordered_map<int, CourseFeed> feeds_;       // guarded by mtx_
+	std::thread verifier_;
+	std::condition_variable verify_cv_;
+	std::deque<uint64_t> verify_pending_;
+	std::map<uint64_t, VerifyRun> verifies_;          // guarded by mtx_, oldest finished ones dropped
+	uint64_t next_verify_id_ = 1;
 	bool stop_ = false;
-	bool running_ = false;
 
 	std::unordered_map<int, CourseProgress> progress_;  // course_id -> progress
 	std::unordered_set<int> paused_courses_;
+	QueueJournal journal_{ "queue.journal" };
+	std::deque<nlohmann::json> history_;  // most recent finished jobs, bounded
+
+	std::mutex manifest_mtx_;
 };
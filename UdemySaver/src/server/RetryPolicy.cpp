@@ -0,0 +1,67 @@
+#include "RetryPolicy.h"
+
+#include "TransferContext.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	struct Backoff {
+		int budget;
+		double base;  // first delay, seconds
+		double cap;
+	};
+
+	const Backoff& backoff_of(RetryPolicy::Class c) {
+		static const Backoff network{ 6, 2.0, 120.0 };
+		static const Backoff server{ 5, 5.0, 300.0 };
+		static const Backoff throttled{ 8, 30.0, 900.0 };
+		static const Backoff auth{ 2, 60.0, 600.0 };
+		static const Backoff permanent{ 0, 0.0, 0.0 };
+		switch (c)
+		{
+		case RetryPolicy::Class::Network:   return network;
+		case RetryPolicy::Class::Server:    return server;
+		case RetryPolicy::Class::Throttled: return throttled;
+		case RetryPolicy::Class::Auth:      return auth;
+		case RetryPolicy::Class::Permanent: return permanent;
+		}
+		return permanent;
+	}
+}
+
+RetryPolicy::Class RetryPolicy::classify(const TransferContext& tc) {
+	const long code = tc.http_status;
+	if (code == 429) return Class::Throttled;
+	if (code >= 500) return Class::Server;
+	if (tc.url_rejected()) return Class::Auth;
+	if (code >= 400) return Class::Permanent;  // 404 and friends will not heal
+	if (tc.network_error) return Class::Network;
+	return Class::Permanent;
+}
+
+const char* RetryPolicy::class_name(Class c) {
+	switch (c)
+	{
+	case Class::Network:   return "network";
+	case Class::Server:    return "server";
+	case Class::Throttled: return "throttled";
+	case Class::Auth:      return "auth";
+	case Class::Permanent: return "permanent";
+	}
+	return "permanent";
+}
+
+int RetryPolicy::budget(Class c) {
+	return backoff_of(c).budget;
+}
+
+double RetryPolicy::delay(Class c, int attempt, long retry_after) {
+	const Backoff& b = backoff_of(c);
+	double ceiling = std::min(b.cap, b.base * std::pow(2.0, std::max(0, attempt - 1)));
+
+	// "equal jitter": at least half the step, so retries of a whole course spread out
+	std::uniform_real_distribution<double> jitter(0.0, ceiling / 2);
+	double d = ceiling / 2 + jitter(rng_);
+	return std::max(d, static_cast<double>(retry_after));
+}
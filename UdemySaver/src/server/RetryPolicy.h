@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <random>
+#include <string>
+
+struct TransferContext;
+
+// Sorts a failed transfer into an error class and decides whether, and
+// after how long, it is tried again. Each class has its own retry budget
+// and exponential backoff with jitter, so a flaky link retries quickly
+// while throttling and auth problems back off for minutes.
+// Not thread safe: RequestHandler only touches it while holding mtx_.
+class RetryPolicy {
+public:
+	enum class Class { Network, Server, Throttled, Auth, Permanent };
+	static constexpr size_t kClasses = 5;
+
+	static Class classify(const TransferContext& tc);
+	static const char* class_name(Class c);
+	static int budget(Class c);  // retries allowed, 0 = fail right away
+
+	// seconds to wait before retry number `attempt` (1-based); a server's
+	// Retry-After is honored as the lower bound
+	double delay(Class c, int attempt, long retry_after = 0);
+
+private:
+	std::mt19937 rng_{ std::random_device{}() };
+};
@@ -0,0 +1,122 @@
+#include "VariantPlanner.h"
+
+#include "Helper.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+	constexpr double kProbeTtlSec = 300.0;
+	constexpr double kLinkShare = 0.85;  // headroom for playlists, retries and the other files of the course
+}
+
+std::vector<VariantPlanner::Variant> VariantPlanner::parse_master(const std::string& playlist) {
+	std::vector<Variant> variants;
+	std::istringstream ss(playlist);
+	std::string line;
+	while (std::getline(ss, line))
+	{
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		std::string trimmed = Helper::trim(line);
+		if (trimmed.rfind("#EXT-X-STREAM-INF", 0) != 0) continue;
+
+		Variant v;
+		auto colon = trimmed.find(':');
+		std::string attrs = (colon == std::string::npos) ? std::string{} : trimmed.substr(colon + 1);
+
+		auto find_attr = [&](const std::string& key) -> std::string
+			{
+				auto pos = attrs.find(key);
+				if (pos == std::string::npos) return {};
+				pos += key.size();
+				auto end = attrs.find(',', pos);
+				std::string val = (end == std::string::npos) ? attrs.substr(pos) : attrs.substr(pos, end - pos);
+				return Helper::trim(val);
+			};
+
+		std::string res = find_attr("RESOLUTION=");
+		auto x = res.find('x');
+		if (x != std::string::npos)
+		{
+			try
+			{
+				v.width = std::stoi(res.substr(0, x));
+				v.height = std::stoi(res.substr(x + 1));
+			}
+			catch (...)
+			{
+				v.width = v.height = 0;
+			}
+		}
+
+		std::string bw = find_attr("BANDWIDTH=");
+		if (!bw.empty())
+		{
+			try { v.bandwidth = std::stoll(bw); }
+			catch (...) { v.bandwidth = 0; }
+		}
+
+		std::string next_line;
+		while (std::getline(ss, next_line))
+		{
+			if (!next_line.empty() && next_line.back() == '\r') next_line.pop_back();
+			std::string url_line = Helper::trim(next_line);
+			if (url_line.empty()) continue;
+			if (url_line.rfind("#", 0) == 0) continue;
+			v.uri = url_line;
+			break;
+		}
+
+		if (!v.uri.empty()) variants.push_back(std::move(v));
+	}
+	return variants;
+}
+
+const VariantPlanner::Variant* VariantPlanner::pick(const std::vector<Variant>& variants, int max_height, double budget_bps) {
+	const Variant* best = nullptr;
+	const Variant* lowest = nullptr;
+	for (auto& v : variants)
+	{
+		if (!lowest || v.bandwidth < lowest->bandwidth) lowest = &v;
+		if (max_height > 0 && v.height > max_height) continue;
+		if (budget_bps > 0.0 && static_cast<double>(v.bandwidth) > budget_bps) continue;
+		if (!best || v.bandwidth > best->bandwidth) best = &v;
+	}
+	return best ? best : lowest;
+}
+
+void VariantPlanner::plan(int course_id, double deadline_at, double media_total) {
+	Course& c = courses_[course_id];
+	c = Course{};
+	c.deadline_at = deadline_at;
+	c.media_total = media_total;
+	c.total_known = media_total > 0.0;
+}
+
+bool VariantPlanner::planned(int course_id, double now) const {
+	auto it = courses_.find(course_id);
+	return it != courses_.end() && now < it->second.deadline_at;
+}
+
+void VariantPlanner::add_media(int course_id, double seconds) {
+	auto it = courses_.find(course_id);
+	if (it == courses_.end() || it->second.total_known || seconds <= 0.0) return;
+	it->second.media_total += seconds;
+}
+
+double VariantPlanner::budget_bps(int course_id, int lecture_id, double lecture_sec, double now, double link_Bps) {
+	auto it = courses_.find(course_id);
+	if (it == courses_.end() || link_Bps <= 0.0) return 0.0;
+	Course& c = it->second;
+
+	double time_left = std::max(c.deadline_at - now, 1.0);
+	double media_left = std::max({ c.media_total - c.media_taken, lecture_sec, 1.0 });
+	double budget = link_Bps * 8.0 * kLinkShare * time_left / media_left;
+
+	if (lecture_id && c.lectures.insert(lecture_id).second) c.media_taken += std::max(lecture_sec, 0.0);
+	return budget;
+}
+
+double VariantPlanner::probe_bps(double now) const {
+	return probe_ts_ > 0.0 && now - probe_ts_ < kProbeTtlSec ? probe_Bps_ : 0.0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Deadline mode for HLS lectures. A course queued with a deadline gets a
+// bitrate budget per lecture: the measured link throughput times the time
+// left, spread over the lecture seconds still to fetch. Each lecture takes
+// the best master-playlist variant whose BANDWIDTH fits that budget and the
+// user's quality ceiling, so a slow link trades quality for finishing on time.
+// A plan ends with the course's last job, a new feed of the course without
+// a deadline, or the deadline itself.
+// Not thread safe: RequestHandler only touches it while holding mtx_.
+class VariantPlanner {
+public:
+	struct Variant {
+		std::string uri;
+		int width = 0;
+		int height = 0;
+		long long bandwidth = 0;  // bits/s, from #EXT-X-STREAM-INF
+	};
+
+	static std::vector<Variant> parse_master(const std::string& playlist);
+
+	// best bandwidth with height <= max_height (0 = any) and bandwidth <=
+	// budget_bps; the lowest variant when nothing fits. nullptr if empty.
+	static const Variant* pick(const std::vector<Variant>& variants, int max_height, double budget_bps);
+
+	// deadline_at in steady-clock seconds; media_total 0 = unknown, summed
+	// from add_media as the curriculum is walked. Plans live in memory only
+	// and are gone after a restart.
+	void plan(int course_id, double deadline_at, double media_total);
+	void drop(int course_id) { courses_.erase(course_id); }
+	// false once the deadline has passed: the course goes back to normal picks
+	bool planned(int course_id, double now) const;
+	void add_media(int course_id, double seconds);
+
+	// bits per media second the lecture may use. The first call for a
+	// lecture takes its seconds off the remaining budget.
+	double budget_bps(int course_id, int lecture_id, double lecture_sec, double now, double link_Bps);
+
+	// single-connection probe, reused for a few minutes; 0 when stale
+	double probe_bps(double now) const;
+	void set_probe(double now, double Bps) { probe_Bps_ = Bps; probe_ts_ = now; }
+
+private:
+	struct Course {
+		double deadline_at = 0.0;
+		double media_total = 0.0;
+		bool total_known = false;
+		double media_taken = 0.0;         // seconds of lectures already budgeted
+		std::unordered_set<int> lectures;
+	};
+
+	std::unordered_map<int, Course> courses_;
+	double probe_Bps_ = 0.0;
+	double probe_ts_ = 0.0;
+};
@@ -0,0 +1,331 @@
+#include "Checksum.h"
+
+#include "Helper.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+	constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+	constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+	constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+	constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+	inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+	inline uint64_t read64(const unsigned char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+	inline uint32_t read32(const unsigned char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+	inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+		acc += input * P2;
+		acc = rotl64(acc, 31);
+		return acc * P1;
+	}
+
+	inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+		acc ^= xxh_round(0, val);
+		return acc * P1 + P4;
+	}
+
+	std::string to_hex(const unsigned char* p, size_t n) {
+		static const char* digits = "0123456789abcdef";
+		std::string out(n * 2, '0');
+		for (size_t i = 0; i < n; ++i)
+		{
+			out[i * 2] = digits[p[i] >> 4];
+			out[i * 2 + 1] = digits[p[i] & 0x0F];
+		}
+		return out;
+	}
+
+	constexpr uint32_t K256[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	inline uint32_t rotr32(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+}
+
+namespace Checksum {
+
+	// ---------------- XXH64 ----------------
+	Xxh64::Xxh64(uint64_t seed) : seed_(seed) {
+		v_[0] = seed + P1 + P2;
+		v_[1] = seed + P2;
+		v_[2] = seed;
+		v_[3] = seed - P1;
+	}
+
+	void Xxh64::update(const void* data, size_t len) {
+		auto* p = static_cast<const unsigned char*>(data);
+		total_ += len;
+
+		if (buf_len_ + len < 32)
+		{
+			std::memcpy(buf_ + buf_len_, p, len);
+			buf_len_ += len;
+			return;
+		}
+
+		if (buf_len_ > 0)
+		{
+			size_t fill = 32 - buf_len_;
+			std::memcpy(buf_ + buf_len_, p, fill);
+			v_[0] = xxh_round(v_[0], read64(buf_));
+			v_[1] = xxh_round(v_[1], read64(buf_ + 8));
+			v_[2] = xxh_round(v_[2], read64(buf_ + 16));
+			v_[3] = xxh_round(v_[3], read64(buf_ + 24));
+			p += fill; len -= fill;
+			buf_len_ = 0;
+		}
+
+		while (len >= 32)
+		{
+			v_[0] = xxh_round(v_[0], read64(p));
+			v_[1] = xxh_round(v_[1], read64(p + 8));
+			v_[2] = xxh_round(v_[2], read64(p + 16));
+			v_[3] = xxh_round(v_[3], read64(p + 24));
+			p += 32; len -= 32;
+		}
+
+		if (len > 0)
+		{
+			std::memcpy(buf_, p, len);
+			buf_len_ = len;
+		}
+	}
+
+	uint64_t Xxh64::digest() const {
+		uint64_t h;
+		if (total_ >= 32)
+		{
+			h = rotl64(v_[0], 1) + rotl64(v_[1], 7) + rotl64(v_[2], 12) + rotl64(v_[3], 18);
+			h = xxh_merge(h, v_[0]);
+			h = xxh_merge(h, v_[1]);
+			h = xxh_merge(h, v_[2]);
+			h = xxh_merge(h, v_[3]);
+		}
+		else
+		{
+			h = seed_ + P5;
+		}
+		h += total_;
+
+		const unsigned char* p = buf_;
+		size_t len = buf_len_;
+		while (len >= 8)
+		{
+			h ^= xxh_round(0, read64(p));
+			h = rotl64(h, 27) * P1 + P4;
+			p += 8; len -= 8;
+		}
+		if (len >= 4)
+		{
+			h ^= static_cast<uint64_t>(read32(p)) * P1;
+			h = rotl64(h, 23) * P2 + P3;
+			p += 4; len -= 4;
+		}
+		while (len > 0)
+		{
+			h ^= (*p) * P5;
+			h = rotl64(h, 11) * P1;
+			++p; --len;
+		}
+
+		h ^= h >> 33; h *= P2;
+		h ^= h >> 29; h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	std::string Xxh64::hex() const {
+		// canonical (big-endian) form, same as `xxhsum -H1`
+		uint64_t h = digest();
+		unsigned char be[8];
+		for (int i = 0; i < 8; ++i) be[i] = static_cast<unsigned char>(h >> (56 - 8 * i));
+		return to_hex(be, 8);
+	}
+
+	// ---------------- SHA-256 ----------------
+	Sha256::Sha256() {
+		h_[0] = 0x6a09e667; h_[1] = 0xbb67ae85; h_[2] = 0x3c6ef372; h_[3] = 0xa54ff53a;
+		h_[4] = 0x510e527f; h_[5] = 0x9b05688c; h_[6] = 0x1f83d9ab; h_[7] = 0x5be0cd19;
+	}
+
+	void Sha256::block(const unsigned char* p) {
+		uint32_t w[64];
+		for (int i = 0; i < 16; ++i)
+		{
+			w[i] = (uint32_t(p[i * 4]) << 24) | (uint32_t(p[i * 4 + 1]) << 16) |
+				(uint32_t(p[i * 4 + 2]) << 8) | uint32_t(p[i * 4 + 3]);
+		}
+		for (int i = 16; i < 64; ++i)
+		{
+			uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3];
+		uint32_t e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+		for (int i = 0; i < 64; ++i)
+		{
+			uint32_t S1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+			uint32_t ch = (e & f) ^ (~e & g);
+			uint32_t t1 = h + S1 + ch + K256[i] + w[i];
+			uint32_t S0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+			uint32_t mj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t t2 = S0 + mj;
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+		h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+	}
+
+	void Sha256::update(const void* data, size_t len) {
+		auto* p = static_cast<const unsigned char*>(data);
+		total_ += len;
+
+		if (buf_len_ > 0)
+		{
+			size_t fill = std::min(len, 64 - buf_len_);
+			std::memcpy(buf_ + buf_len_, p, fill);
+			buf_len_ += fill; p += fill; len -= fill;
+			if (buf_len_ < 64) return;
+			block(buf_);
+			buf_len_ = 0;
+		}
+
+		while (len >= 64)
+		{
+			block(p);
+			p += 64; len -= 64;
+		}
+
+		if (len > 0)
+		{
+			std::memcpy(buf_, p, len);
+			buf_len_ = len;
+		}
+	}
+
+	std::string Sha256::hex() const {
+		Sha256 tmp = *this;
+		uint64_t bits = total_ * 8;
+
+		unsigned char pad[72] = { 0x80 };
+		size_t pad_len = (tmp.buf_len_ < 56) ? (56 - tmp.buf_len_) : (120 - tmp.buf_len_);
+		for (int i = 0; i < 8; ++i) pad[pad_len + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+		tmp.update(pad, pad_len + 8);
+
+		unsigned char out[32];
+		for (int i = 0; i < 8; ++i)
+		{
+			out[i * 4] = static_cast<unsigned char>(tmp.h_[i] >> 24);
+			out[i * 4 + 1] = static_cast<unsigned char>(tmp.h_[i] >> 16);
+			out[i * 4 + 2] = static_cast<unsigned char>(tmp.h_[i] >> 8);
+			out[i * 4 + 3] = static_cast<unsigned char>(tmp.h_[i]);
+		}
+		return to_hex(out, 32);
+	}
+
+	// ---------------- StreamHasher ----------------
+	bool StreamHasher::update_from_file(const std::string& path, std::string& err) {
+		MappedFile mf;
+		if (!mf.open(path, err)) return false;
+		if (mf.size() > 0) update(mf.data(), static_cast<size_t>(mf.size()));
+		return true;
+	}
+
+	// ---------------- MappedFile ----------------
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+#ifdef _WIN32
+	bool MappedFile::open(const std::string& path, std::string& err) {
+		close();
+
+		int needed = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+		if (needed <= 0) { err = "bad path"; return false; }
+		std::wstring wpath(static_cast<size_t>(needed - 1), L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, wpath.data(), needed);
+
+		HANDLE f = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (f == INVALID_HANDLE_VALUE) { err = "cannot open file"; return false; }
+		file_ = f;
+
+		LARGE_INTEGER sz{};
+		if (!GetFileSizeEx(f, &sz)) { close(); err = "cannot stat file"; return false; }
+		size_ = static_cast<uint64_t>(sz.QuadPart);
+		if (size_ == 0) return true; // empty files cannot be mapped
+
+		HANDLE m = CreateFileMappingW(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m) { close(); err = "CreateFileMapping failed"; return false; }
+		mapping_ = m;
+
+		void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+		if (!view) { close(); err = "MapViewOfFile failed"; return false; }
+		data_ = static_cast<const unsigned char*>(view);
+		return true;
+	}
+
+	void MappedFile::close() {
+		if (data_) UnmapViewOfFile(data_);
+		if (mapping_) CloseHandle(static_cast<HANDLE>(mapping_));
+		if (file_) CloseHandle(static_cast<HANDLE>(file_));
+		data_ = nullptr; mapping_ = nullptr; file_ = nullptr; size_ = 0;
+	}
+#else
+	bool MappedFile::open(const std::string& path, std::string& err) {
+		close();
+
+		fd_ = ::open(path.c_str(), O_RDONLY);
+		if (fd_ < 0) { err = "cannot open file"; return false; }
+
+		struct stat st {};
+		if (fstat(fd_, &st) != 0) { close(); err = "cannot stat file"; return false; }
+		size_ = static_cast<uint64_t>(st.st_size);
+		if (size_ == 0) return true;
+
+		void* p = mmap(nullptr, static_cast<size_t>(size_), PROT_READ, MAP_PRIVATE, fd_, 0);
+		if (p == MAP_FAILED) { close(); err = "mmap failed"; return false; }
+		madvise(p, static_cast<size_t>(size_), MADV_SEQUENTIAL);
+		data_ = static_cast<const unsigned char*>(p);
+		return true;
+	}
+
+	void MappedFile::close() {
+		if (data_) munmap(const_cast<unsigned char*>(data_), static_cast<size_t>(size_));
+		if (fd_ >= 0) ::close(fd_);
+		data_ = nullptr; fd_ = -1; size_ = 0;
+	}
+#endif
+
+	bool hash_file(const std::string& path, bool with_sha256,
+				   std::string& xxh64, std::string& sha256, std::string& err) {
+		StreamHasher h(with_sha256);
+		if (!h.update_from_file(path, err)) return false;
+		xxh64 = h.xxh64_hex();
+		sha256 = h.sha256_hex();
+		return true;
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Checksum {
+
+    // XXH64, streaming. Fast non-cryptographic hash used for the per-course manifest.
+    class Xxh64 {
+    public:
+        explicit Xxh64(uint64_t seed = 0);
+
+        void update(const void* data, size_t len);
+        uint64_t digest() const;
+        std::string hex() const;
+
+    private:
+        uint64_t v_[4];
+        uint64_t seed_;
+        uint64_t total_ = 0;
+        unsigned char buf_[32];
+        size_t buf_len_ = 0;
+    };
+
+    // SHA-256, streaming. Optional, only computed when checksum_sha256=true.
+    class Sha256 {
+    public:
+        Sha256();
+
+        void update(const void* data, size_t len);
+        std::string hex() const;
+
+    private:
+        void block(const unsigned char* p);
+
+        uint32_t h_[8];
+        uint64_t total_ = 0;
+        unsigned char buf_[64];
+        size_t buf_len_ = 0;
+    };
+
+    // Feeds every written chunk to xxh64 and (optionally) sha256.
+    class StreamHasher {
+    public:
+        explicit StreamHasher(bool with_sha256 = false) : with_sha256_(with_sha256) {}
+
+        void update(const void* data, size_t len) {
+            xxh_.update(data, len);
+            if (with_sha256_) sha_.update(data, len);
+        }
+
+        // seeds the hasher with bytes already on disk (resumed .part files)
+        bool update_from_file(const std::string& path, std::string& err);
+
+        std::string xxh64_hex() const { return xxh_.hex(); }
+        std::string sha256_hex() const { return with_sha256_ ? sha_.hex() : std::string{}; }
+
+    private:
+        bool with_sha256_;
+        Xxh64 xxh_;
+        Sha256 sha_;
+    };
+
+    // Read-only memory mapping of a whole file (UTF-8 path).
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& path, std::string& err);
+        void close();
+
+        const unsigned char* data() const { return data_; }
+        uint64_t size() const { return size_; }
+
+    private:
+        const unsigned char* data_ = nullptr;
+        uint64_t size_ = 0;
+#ifdef _WIN32
+        void* file_ = nullptr;
+        void* mapping_ = nullptr;
+#else
+        int fd_ = -1;
+#endif
+    };
+
+    // mmap + hash in one go; used by /verify
+    bool hash_file(const std::string& path, bool with_sha256,
+                   std::string& xxh64, std::string& sha256, std::string& err);
+}
@@ -0,0 +1,256 @@
+#include "CurlInput.h"
+
+#include "Helper.h"
+#include "TransferContext.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/aes.h>
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+namespace {
+	constexpr int kAttempts = 4;
+	constexpr int kBufferSize = 1 << 16;
+	constexpr const char* kUserAgent = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36";
+
+	int abort_cb(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+		auto* ctx = static_cast<const TransferContext*>(clientp);
+		return ctx && ctx->stop_requested() ? 1 : 0;
+	}
+
+	int averror_of(long code) {
+		switch (code)
+		{
+		case 400: return AVERROR_HTTP_BAD_REQUEST;
+		case 401: return AVERROR_HTTP_UNAUTHORIZED;
+		case 403: return AVERROR_HTTP_FORBIDDEN;
+		case 404: return AVERROR_HTTP_NOT_FOUND;
+		default:  return code >= 500 ? AVERROR_HTTP_SERVER_ERROR : AVERROR_HTTP_OTHER_4XX;
+		}
+	}
+
+	bool is_http(const char* url) {
+		return std::strncmp(url, "http://", 7) == 0 || std::strncmp(url, "https://", 8) == 0;
+	}
+
+	long long dict_int(const AVDictionary* opts, const char* key, long long def) {
+		const AVDictionaryEntry* e = opts ? av_dict_get(opts, key, nullptr, 0) : nullptr;
+		return e && e->value ? std::strtoll(e->value, nullptr, 10) : def;
+	}
+
+	bool hex16(const AVDictionary* opts, const char* key, uint8_t out[16]) {
+		const AVDictionaryEntry* e = opts ? av_dict_get(opts, key, nullptr, 0) : nullptr;
+		if (!e || !e->value || std::strlen(e->value) < 32) return false;
+		for (int i = 0; i < 16; ++i)
+		{
+			char byte[3] = { e->value[2 * i], e->value[2 * i + 1], 0 };
+			char* end = nullptr;
+			out[i] = static_cast<uint8_t>(std::strtoul(byte, &end, 16));
+			if (end != byte + 2) return false;
+		}
+		return true;
+	}
+
+	// AES-128-CBC with PKCS#7 padding, what ffmpeg's crypto protocol does
+	// for #EXT-X-KEY:METHOD=AES-128 segments
+	bool decrypt_aes128(std::string& body, const AVDictionary* opts) {
+		uint8_t key[16], iv[16];
+		if (!hex16(opts, "key", key) || !hex16(opts, "iv", iv)) return false;
+		if (body.empty() || body.size() % 16 != 0) return false;
+
+		std::unique_ptr<AVAES, decltype(&av_free)> aes(av_aes_alloc(), &av_free);
+		if (!aes || av_aes_init(aes.get(), key, 128, 1) < 0) return false;
+		auto* data = reinterpret_cast<uint8_t*>(body.data());
+		av_aes_crypt(aes.get(), data, data, static_cast<int>(body.size() / 16), iv, 1);
+
+		uint8_t pad = data[body.size() - 1];
+		if (pad == 0 || pad > 16) return false;
+		body.resize(body.size() - pad);
+		return true;
+	}
+}
+
+struct CurlInput::Resource {
+	std::string body;
+	int64_t pos = 0;
+};
+
+CurlInput::CurlInput(std::vector<std::string> headers, std::string proxy, const TransferContext* ctx, std::string cache_dir)
+	: headers_(std::move(headers)), proxy_(std::move(proxy)), ctx_(ctx), cache_(std::move(cache_dir)) {
+	easy_ = curl_easy_init();
+	if (!easy_) return;
+
+	for (auto& h : headers_) hdr_ = curl_slist_append(hdr_, h.c_str());
+	curl_easy_setopt(easy_, CURLOPT_HTTPHEADER, hdr_);
+	curl_easy_setopt(easy_, CURLOPT_USERAGENT, kUserAgent);
+	curl_easy_setopt(easy_, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(easy_, CURLOPT_MAXREDIRS, 8L);
+	curl_easy_setopt(easy_, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(easy_, CURLOPT_CONNECTTIMEOUT_MS, 8000L);
+	curl_easy_setopt(easy_, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt(easy_, CURLOPT_LOW_SPEED_TIME, 30L);
+	curl_easy_setopt(easy_, CURLOPT_WRITEFUNCTION, Helper::write_to_string);
+	curl_easy_setopt(easy_, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(easy_, CURLOPT_XFERINFOFUNCTION, abort_cb);
+	curl_easy_setopt(easy_, CURLOPT_XFERINFODATA, ctx_);
+	if (!proxy_.empty()) curl_easy_setopt(easy_, CURLOPT_PROXY, proxy_.c_str());
+}
+
+CurlInput::~CurlInput() {
+	if (hdr_) curl_slist_free_all(hdr_);
+	if (easy_) curl_easy_cleanup(easy_);
+}
+
+bool CurlInput::attach(AVFormatContext* s) {
+#if LIBAVFORMAT_VERSION_MAJOR >= 59
+	if (!s || !easy_) return false;
+	default_open_ = s->io_open;
+	default_close_ = s->io_close2;
+	s->opaque = this;
+	s->io_open = &CurlInput::io_open;
+	s->io_close2 = &CurlInput::io_close2;
+	return true;
+#else
+	(void) s;
+	return false;
+#endif
+}
+
+int CurlInput::io_open(AVFormatContext* s, AVIOContext** pb, const char* url, int flags, AVDictionary** options) {
+	auto* self = static_cast<CurlInput*>(s->opaque);
+	// the hls demuxer opens AES-128 segments as crypto+<url> with key/iv options
+	const bool crypto = std::strncmp(url, "crypto+", 7) == 0;
+	const char* target = crypto ? url + 7 : url;
+	if ((flags & AVIO_FLAG_WRITE) || !is_http(target))
+		return self->default_open_ ? self->default_open_(s, pb, url, flags, options) : AVERROR(ENOSYS);
+	return self->open(pb, target, options ? *options : nullptr, crypto);
+}
+
+int CurlInput::io_close2(AVFormatContext* s, AVIOContext* pb) {
+	auto* self = static_cast<CurlInput*>(s->opaque);
+	if (!pb) return 0;
+	if (!self->open_.erase(pb))
+		return self->default_close_ ? self->default_close_(s, pb) : 0;
+
+	delete static_cast<Resource*>(pb->opaque);
+	av_freep(&pb->buffer);
+	avio_context_free(&pb);
+	return 0;
+}
+
+int CurlInput::open(AVIOContext** pb, const std::string& url, const AVDictionary* opts, bool crypto) {
+	auto res = std::make_unique<Resource>();
+
+	// #EXT-X-BYTERANGE segments come as offset/end_offset, like for ffmpeg's http protocol
+	const long long offset = dict_int(opts, "offset", 0);
+	const long long end_offset = dict_int(opts, "end_offset", 0);
+	std::string range;
+	if (offset > 0 || end_offset > 0)
+		range = std::to_string(offset) + "-" + (end_offset > offset ? std::to_string(end_offset - 1) : std::string{});
+
+	// playlists carry freshly signed segment urls and are always fetched
+	const std::string path = url.substr(0, url.find_first_of("?#"));
+	const bool playlist = path.size() >= 5 && (path.compare(path.size() - 5, 5, ".m3u8") == 0 || path.compare(path.size() - 4, 4, ".m3u") == 0);
+	if (playlist || !cache_.read(url, range, res->body))
+	{
+		int ret = fetch(url, range, res->body);
+		if (ret < 0) return ret;
+		if (!playlist && res->body.rfind("#EXTM3U", 0) != 0) cache_.store(url, range, res->body);
+	}
+	if (crypto && !decrypt_aes128(res->body, opts))
+	{
+		error_ = path + ": cannot decrypt segment";
+		return AVERROR_INVALIDDATA;
+	}
+
+	auto* buf = static_cast<unsigned char*>(av_malloc(kBufferSize));
+	AVIOContext* io = buf ? avio_alloc_context(buf, kBufferSize, 0, res.get(), &CurlInput::read_packet, nullptr, &CurlInput::seek) : nullptr;
+	if (!io)
+	{
+		av_free(buf);
+		return AVERROR(ENOMEM);
+	}
+	res.release();
+	open_.insert(io);
+	*pb = io;
+	return 0;
+}
+
+int CurlInput::fetch(const std::string& url, const std::string& range, std::string& body) {
+	long code = 0;
+	CURLcode rc = CURLE_OK;
+
+	curl_easy_setopt(easy_, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(easy_, CURLOPT_RANGE, range.empty() ? nullptr : range.c_str());
+	curl_easy_setopt(easy_, CURLOPT_WRITEDATA, &body);
+	for (int attempt = 0; attempt < kAttempts; ++attempt)
+	{
+		if (attempt > 0)
+		{
+			// back off a little and come back on a new connection
+			for (int t = 0; t < attempt * 10 && !(ctx_ && ctx_->stop_requested()); ++t)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			curl_easy_setopt(easy_, CURLOPT_FRESH_CONNECT, 1L);
+		}
+		body.clear();
+		code = 0;
+		rc = curl_easy_perform(easy_);
+		curl_easy_getinfo(easy_, CURLINFO_RESPONSE_CODE, &code);
+		curl_easy_setopt(easy_, CURLOPT_FRESH_CONNECT, 0L);
+
+		curl_off_t got = 0;
+		if (curl_easy_getinfo(easy_, CURLINFO_SIZE_DOWNLOAD_T, &got) == CURLE_OK) net_bytes_ += got;
+
+		if (rc == CURLE_OK || rc == CURLE_ABORTED_BY_CALLBACK) break;
+		if (code >= 400 && code < 500 && code != 408 && code != 429) break;  // retrying will not help
+	}
+	curl_easy_setopt(easy_, CURLOPT_WRITEDATA, nullptr);
+	curl_easy_setopt(easy_, CURLOPT_RANGE, nullptr);
+
+	if (rc == CURLE_OK) return 0;
+	if (rc == CURLE_ABORTED_BY_CALLBACK) return AVERROR_EXIT;
+	http_status_ = code >= 400 ? code : 0;
+	network_error_ = http_status_ == 0;
+	error_ = url.substr(0, url.find('?')) + ": " +
+		(http_status_ ? "http " + std::to_string(http_status_) : std::string(curl_easy_strerror(rc)));
+	return http_status_ ? averror_of(http_status_) : AVERROR(EIO);
+}
+
+int CurlInput::read_packet(void* opaque, uint8_t* buf, int buf_size) {
+	auto* res = static_cast<Resource*>(opaque);
+	int64_t left = static_cast<int64_t>(res->body.size()) - res->pos;
+	if (left <= 0) return AVERROR_EOF;
+	int n = static_cast<int>(std::min<int64_t>(buf_size, left));
+	std::memcpy(buf, res->body.data() + res->pos, n);
+	res->pos += n;
+	return n;
+}
+
+int64_t CurlInput::seek(void* opaque, int64_t offset, int whence) {
+	auto* res = static_cast<Resource*>(opaque);
+	const int64_t size = static_cast<int64_t>(res->body.size());
+	whence &= ~AVSEEK_FORCE;
+	if (whence == AVSEEK_SIZE) return size;
+
+	int64_t target = offset;
+	if (whence == SEEK_CUR) target = res->pos + offset;
+	else if (whence == SEEK_END) target = size + offset;
+	else if (whence != SEEK_SET) return AVERROR(EINVAL);
+
+	if (target < 0 || target > size) return AVERROR(EINVAL);
+	res->pos = target;
+	return target;
+}
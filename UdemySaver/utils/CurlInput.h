@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "SegmentCache.h"
+
+typedef void CURL;
+struct curl_slist;
+struct AVFormatContext;
+struct AVIOContext;
+struct AVDictionary;
+struct TransferContext;
+
+// Network input for ffmpeg's own demuxer over libcurl. attach() replaces the
+// io_open/io_close2 callbacks of an input context, so the playlists, keys and
+// segments the hls demuxer opens come through one curl handle: its
+// connection and TLS session are reused from request to request, a pause or
+// cancel aborts the request in flight, and every byte is counted.
+//
+// Each resource is fetched whole (retried on a fresh connection like the
+// segment fetcher) and then served from memory, seekable. Byte-range
+// segments are fetched as ranges, and AES-128 segments (crypto+https://)
+// are fetched here and decrypted in memory instead of going through
+// ffmpeg's crypto and http protocols.
+//
+// With a cache directory every segment and key (not playlists) is also kept
+// in a SegmentCache, so a paused or failed lecture fetches only what it is
+// missing when it starts again, whichever download path that run takes.
+class CurlInput {
+public:
+    CurlInput(std::vector<std::string> headers, std::string proxy, const TransferContext* ctx = nullptr, std::string cache_dir = {});
+    ~CurlInput();
+    CurlInput(const CurlInput&) = delete;
+    CurlInput& operator=(const CurlInput&) = delete;
+
+    // sets s->opaque; non-http urls still go through ffmpeg's default.
+    // False before libavformat 59 (no io_close2), leaving ffmpeg's http client.
+    bool attach(AVFormatContext* s);
+
+    long long net_bytes() const { return net_bytes_; }
+
+    // last failed request, for the caller's error message / retry class
+    long http_status() const { return http_status_; }
+    bool network_error() const { return network_error_; }
+    const std::string& error() const { return error_; }
+
+private:
+    struct Resource;
+
+    static int io_open(AVFormatContext* s, AVIOContext** pb, const char* url, int flags, AVDictionary** options);
+    static int io_close2(AVFormatContext* s, AVIOContext* pb);
+    static int read_packet(void* opaque, uint8_t* buf, int buf_size);
+    static int64_t seek(void* opaque, int64_t offset, int whence);
+
+    int open(AVIOContext** pb, const std::string& url, const AVDictionary* opts, bool crypto);
+    int fetch(const std::string& url, const std::string& range, std::string& body);
+
+    std::vector<std::string> headers_;
+    std::string proxy_;
+    const TransferContext* ctx_;
+    SegmentCache cache_;
+
+    CURL* easy_ = nullptr;  // kept for the whole transfer
+    curl_slist* hdr_ = nullptr;
+
+    int (*default_open_)(AVFormatContext*, AVIOContext**, const char*, int, AVDictionary**) = nullptr;
+    int (*default_close_)(AVFormatContext*, AVIOContext*) = nullptr;
+    std::set<AVIOContext*> open_;  // contexts created here, freed by io_close2
+
+    long long net_bytes_ = 0;
+    long http_status_ = 0;
+    bool network_error_ = false;
+    std::string error_;
+};
@@ -1,10 +1,28 @@
 #include "FFmpegHelper.h"
 
+#include "Checksum.h"
+#include "CurlInput.h"
 #include "Helper.h"
+#include "HlsFetcher.h"
+#include "ProbeCache.h"
+#include "TransferContext.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <system_error>
+#include <thread>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -13,6 +31,334 @@ extern "C" {
 #include <libavutil/dict.h>
 #include <libavutil/error.h>
 #include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+using avio_write_buf_t = const uint8_t*;
+#else
+using avio_write_buf_t = uint8_t*;
+#endif
+
+namespace {
+	constexpr int kOutputBufferSize = 1 << 20;
+	constexpr size_t kMaxQueuedBytes = 32u << 20;  // write-behind backlog before the muxer waits
+	constexpr int64_t kFastProbeSize = 64 << 10;            // bytes read by a cached-rendition probe
+	constexpr int64_t kFastAnalyzeDuration = 500000;        // and at most this much stream, microseconds
+
+	using Clock = std::chrono::steady_clock;
+
+	double ms_since(Clock::time_point t0) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+	}
+
+	// Muxer output. The muxer thread only queues its buffers; a writer thread
+	// writes them to the .part file and hashes them on the way, so a slow disk
+	// does not hold up the network reads and the finished file never has to
+	// be read back for its checksum. A seek (the mp4 muxer patching earlier
+	// bytes) waits for the queue to drain first.
+	struct OutputSink {
+		FILE* fp = nullptr;
+		Checksum::StreamHasher hasher;  // writer thread only
+		int64_t pos = 0;                // logical position seen by the muxer
+		int64_t end = 0;
+		bool sequential = true; // false once the muxer rewrites earlier bytes
+
+		struct Chunk {
+			std::vector<uint8_t> data;
+			bool hash;
+		};
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<Chunk> queue;
+		size_t queued = 0;
+		bool busy = false;      // writer holds a chunk outside the queue
+		bool done = false;
+		bool failed = false;
+		std::thread writer;
+		double wait_ms = 0.0;   // muxer blocked on a full queue
+
+		explicit OutputSink(bool with_sha256) : hasher(with_sha256) {}
+		~OutputSink() { finish(); }
+
+		void start() {
+			writer = std::thread([this] { write_loop(); });
+		}
+
+		void write_loop() {
+			std::unique_lock<std::mutex> lk(mtx);
+			while (true)
+			{
+				cv.wait(lk, [&] { return done || !queue.empty(); });
+				if (queue.empty()) return;
+				Chunk c = std::move(queue.front());
+				queue.pop_front();
+				busy = true;
+				lk.unlock();
+
+				bool ok = fwrite(c.data.data(), 1, c.data.size(), fp) == c.data.size();
+				if (ok && c.hash) hasher.update(c.data.data(), c.data.size());
+
+				lk.lock();
+				busy = false;
+				queued -= c.data.size();
+				if (!ok) failed = true;
+				cv.notify_all();
+			}
+		}
+
+		bool push(const uint8_t* buf, size_t n, bool hash) {
+			std::unique_lock<std::mutex> lk(mtx);
+			if (queued >= kMaxQueuedBytes)
+			{
+				auto t0 = Clock::now();
+				cv.wait(lk, [&] { return failed || queued < kMaxQueuedBytes; });
+				wait_ms += ms_since(t0);
+			}
+			if (failed || done) return false;
+			queue.push_back({ std::vector<uint8_t>(buf, buf + n), hash });
+			queued += n;
+			cv.notify_all();
+			return true;
+		}
+
+		bool drain() {
+			std::unique_lock<std::mutex> lk(mtx);
+			cv.wait(lk, [&] { return failed || (queue.empty() && !busy); });
+			return !failed;
+		}
+
+		// stops the writer once everything queued is on disk; false on a write error
+		bool finish() {
+			if (writer.joinable())
+			{
+				{
+					std::lock_guard<std::mutex> lk(mtx);
+					done = true;
+				}
+				cv.notify_all();
+				writer.join();
+			}
+			return !failed;
+		}
+	};
+
+	long http_status_of(int err) {
+		switch (err)
+		{
+		case AVERROR_HTTP_BAD_REQUEST:  return 400;
+		case AVERROR_HTTP_UNAUTHORIZED: return 401;
+		case AVERROR_HTTP_FORBIDDEN:    return 403;
+		case AVERROR_HTTP_NOT_FOUND:    return 404;
+		case AVERROR_HTTP_SERVER_ERROR: return 500;
+		default:                        return 0;
+		}
+	}
+
+	// lets a pause/cancel request break out of blocking network reads
+	int interrupt_cb(void* opaque) {
+		return static_cast<const TransferContext*>(opaque)->stop_requested() ? 1 : 0;
+	}
+
+	bool is_network_error(int err) {
+		return err == AVERROR(ETIMEDOUT) || err == AVERROR(ECONNRESET) || err == AVERROR(ECONNREFUSED) ||
+			err == AVERROR(EHOSTUNREACH) || err == AVERROR(ENETUNREACH) || err == AVERROR(EPIPE);
+	}
+
+	// Room for the moov atom at the front of a plain mp4: about 32 bytes of
+	// sample tables per packet, with headroom. The muxer fails cleanly if it
+	// is still too small, so err on the large side.
+	int64_t moov_reserve(const AVFormatContext* in, double duration) {
+		double per_sec = 0.0;
+		for (unsigned int i = 0; i < in->nb_streams; ++i)
+		{
+			const AVStream* st = in->streams[i];
+			if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+				per_sec += st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0 ? av_q2d(st->avg_frame_rate) : 60.0;
+			else if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+				per_sec += st->codecpar->sample_rate > 0 ? st->codecpar->sample_rate / 1024.0 : 50.0;
+		}
+		return static_cast<int64_t>(duration * per_sec * 32.0 * 1.5) + (256 << 10);
+	}
+
+	// A caption track converted to mov_text up front: cues are few and
+	// small, so they are held in memory and interleaved into the remux as
+	// the video passes their start time.
+	struct CaptionTrack {
+		std::string lang;
+		AVCodecParameters* par = nullptr;
+		std::vector<AVPacket*> cues;  // pts/duration in milliseconds from the stream start
+		size_t next = 0;
+		int out_index = -1;
+
+		CaptionTrack() = default;
+		CaptionTrack(CaptionTrack&& o) noexcept
+			: lang(std::move(o.lang)), par(o.par), cues(std::move(o.cues)), next(o.next), out_index(o.out_index) {
+			o.par = nullptr;
+		}
+		~CaptionTrack() {
+			for (auto*& p : cues) av_packet_free(&p);
+			avcodec_parameters_free(&par);
+		}
+	};
+
+	// mp4 wants ISO 639-2 language codes; Udemy gives locales like "en_US"
+	const char* iso639_2(const std::string& lang) {
+		static const char* const map[][2] = {
+			{ "ar", "ara" }, { "de", "deu" }, { "en", "eng" }, { "es", "spa" }, { "fr", "fra" },
+			{ "hi", "hin" }, { "id", "ind" }, { "it", "ita" }, { "ja", "jpn" }, { "ko", "kor" },
+			{ "nl", "nld" }, { "pl", "pol" }, { "pt", "por" }, { "ru", "rus" }, { "tr", "tur" },
+			{ "zh", "zho" },
+		};
+		for (auto& m : map)
+			if (lang.size() >= 2 && (lang.size() == 2 || !std::isalpha(static_cast<unsigned char>(lang[2]))) && lang.compare(0, 2, m[0]) == 0)
+				return m[1];
+		return nullptr;
+	}
+
+	// Fetches one caption file (WebVTT or SRT) through curl, decodes its cues
+	// and re-encodes them as mov_text packets.
+	bool load_caption(const std::string& url, const std::vector<std::string>& headers, const std::string& proxy,
+					  const TransferContext* ctx, CaptionTrack& track, std::string& err) {
+		CurlInput curl(headers, proxy, ctx);
+		AVFormatContext* in = avformat_alloc_context();
+		AVCodecContext* dec = nullptr;
+		AVCodecContext* enc = nullptr;
+		AVPacket* pkt = av_packet_alloc();
+		auto done = [&](bool ok)
+			{
+				av_packet_free(&pkt);
+				avcodec_free_context(&dec);
+				avcodec_free_context(&enc);
+				avformat_close_input(&in);
+				return ok;
+			};
+		if (!in || !pkt) { err = "out of memory"; return done(false); }
+		curl.attach(in);
+
+		int ret = avformat_open_input(&in, url.c_str(), nullptr, nullptr);
+		if (ret >= 0) ret = avformat_find_stream_info(in, nullptr);
+		if (ret < 0)
+		{
+			err = curl.error().empty() ? Helper::ff_errstr(ret) : curl.error();
+			return done(false);
+		}
+		if (in->nb_streams < 1 || in->streams[0]->codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE)
+		{
+			err = "not a subtitle file";
+			return done(false);
+		}
+		AVStream* st = in->streams[0];
+
+		const AVCodec* dcodec = avcodec_find_decoder(st->codecpar->codec_id);
+		const AVCodec* ecodec = avcodec_find_encoder(AV_CODEC_ID_MOV_TEXT);
+		dec = dcodec ? avcodec_alloc_context3(dcodec) : nullptr;
+		enc = ecodec ? avcodec_alloc_context3(ecodec) : nullptr;
+		if (!dec || !enc) { err = "no subtitle codec"; return done(false); }
+		avcodec_parameters_to_context(dec, st->codecpar);
+		dec->pkt_timebase = st->time_base;
+		if ((ret = avcodec_open2(dec, dcodec, nullptr)) < 0) { err = Helper::ff_errstr(ret); return done(false); }
+
+		// the mov_text sample description is built from the decoder's ASS header
+		enc->time_base = AVRational{ 1, 1000 };
+		if (dec->subtitle_header_size > 0)
+		{
+			enc->subtitle_header = static_cast<uint8_t*>(av_mallocz(dec->subtitle_header_size + 1));
+			if (enc->subtitle_header)
+			{
+				std::memcpy(enc->subtitle_header, dec->subtitle_header, dec->subtitle_header_size);
+				enc->subtitle_header_size = dec->subtitle_header_size;
+			}
+		}
+		if ((ret = avcodec_open2(enc, ecodec, nullptr)) < 0) { err = Helper::ff_errstr(ret); return done(false); }
+
+		std::vector<uint8_t> buf(64 * 1024);
+		while (av_read_frame(in, pkt) >= 0)
+		{
+			AVSubtitle sub{};
+			int got = 0;
+			ret = avcodec_decode_subtitle2(dec, &sub, &got, pkt);
+			av_packet_unref(pkt);
+			if (ret < 0 || !got) continue;
+
+			int64_t start = av_rescale_q(sub.pts, AVRational{ 1, AV_TIME_BASE }, AVRational{ 1, 1000 }) + sub.start_display_time;
+			int64_t length = static_cast<int64_t>(sub.end_display_time) - sub.start_display_time;
+			sub.end_display_time -= sub.start_display_time;
+			sub.start_display_time = 0;
+			int n = sub.pts != AV_NOPTS_VALUE ? avcodec_encode_subtitle(enc, buf.data(), static_cast<int>(buf.size()), &sub) : -1;
+			avsubtitle_free(&sub);
+			if (n <= 0) continue;
+
+			AVPacket* cue = av_packet_alloc();
+			if (!cue || av_new_packet(cue, n) < 0)
+			{
+				av_packet_free(&cue);
+				err = "out of memory";
+				return done(false);
+			}
+			std::memcpy(cue->data, buf.data(), n);
+			cue->pts = cue->dts = start;
+			cue->duration = length > 0 ? length : 0;
+			cue->flags |= AV_PKT_FLAG_KEY;
+			track.cues.push_back(cue);
+		}
+
+		track.par = avcodec_parameters_alloc();
+		if (!track.par || avcodec_parameters_from_context(track.par, enc) < 0)
+		{
+			err = "codec parameters";
+			return done(false);
+		}
+		return done(true);
+	}
+
+	int64_t file_seek64(FILE* fp, int64_t off, int whence) {
+#ifdef _WIN32
+		return _fseeki64(fp, off, whence);
+#else
+		return fseeko(fp, static_cast<off_t>(off), whence);
+#endif
+	}
+
+	int sink_write(void* opaque, avio_write_buf_t buf, int buf_size) {
+		auto* sink = static_cast<OutputSink*>(opaque);
+		if (buf_size <= 0) return 0;
+
+		size_t n = static_cast<size_t>(buf_size);
+		if (sink->pos != sink->end) sink->sequential = false;
+		if (!sink->push(buf, n, sink->sequential)) return AVERROR(EIO);
+
+		sink->pos += static_cast<int64_t>(n);
+		if (sink->pos > sink->end) sink->end = sink->pos;
+		return buf_size;
+	}
+
+	int64_t sink_seek(void* opaque, int64_t offset, int whence) {
+		auto* sink = static_cast<OutputSink*>(opaque);
+		whence &= ~AVSEEK_FORCE;
+		if (whence == AVSEEK_SIZE) return sink->end;
+
+		int64_t target = offset;
+		if (whence == SEEK_CUR) target = sink->pos + offset;
+		else if (whence == SEEK_END) target = sink->end + offset;
+		else if (whence != SEEK_SET) return AVERROR(EINVAL);
+
+		if (target < 0) return AVERROR(EINVAL);
+		if (target == sink->pos) return target;
+		if (!sink->drain()) return AVERROR(EIO);
+		if (file_seek64(sink->fp, target, SEEK_SET) != 0) return AVERROR(EIO);
+		sink->pos = target;
+		return target;
+	}
+}
+
+std::string FFmpegHelper::container_name(const std::string& s) {
+	if (s == "mp4" || s == "fmp4") return s;
+	return "ts";
+}
+
+const char* FFmpegHelper::container_extension(const std::string& container) {
+	return container_name(container) == "ts" ? ".ts" : ".mp4";
 }
 
 bool FFmpegHelper::convert_m3u8_to_ts(
@@ -21,9 +367,13 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 	const std::vector<std::string>& extra_headers,
 	const std::string& proxy,
 	std::function<void(double, double)> on_progress,
-	std::string& msg) {
+	std::string& msg,
+	TransferContext* ctx) {
 	msg.clear();
 
+	// the remux output always starts over; what survives a failed or paused
+	// attempt is the segment cache in <out>.segs, which the fetcher or
+	// CurlInput reads back
 	std::string tmp_path = out_path + ".part";
 	{
 		std::error_code ec;
@@ -39,19 +389,47 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 	AVFormatContext* in_ctx = nullptr;
 	AVFormatContext* out_ctx = nullptr;
 	AVDictionary* in_opts = nullptr;
+	AVIOContext* in_pb = nullptr;           // custom input when the segment fetcher is used
+	std::unique_ptr<HlsFetcher> fetcher;
+	std::unique_ptr<CurlInput> curl_in;     // network input of the native demuxer
+	OutputSink sink(ctx && ctx->want_sha256);
+	AVPacket* pkt = nullptr;
+	std::vector<CaptionTrack> captions;
+	if (ctx) ctx->captions_skipped.clear();
+	HlsStages stages;
+	const auto t_begin = Clock::now();
 
 	auto last_progress = std::chrono::steady_clock::now();
 	const std::chrono::milliseconds progress_interval(350);
 	long long estimated_total_bytes = 0;
 	long long bytes_written = 0;
+	double media_total = 0.0;  // playlist duration, seconds
+	double media_done = 0.0;   // furthest packet end remuxed, seconds from the stream start
 
 	auto report_progress = [&](bool force = false)
 	{
-		if (!on_progress) return;
+		if (!on_progress && !(ctx && (ctx->on_media_progress || ctx->on_stages))) return;
 		auto now = std::chrono::steady_clock::now();
 		if (!force && now - last_progress < progress_interval) return;
 		last_progress = now;
 
+		if (ctx && ctx->on_media_progress && media_total > 0.0)
+			ctx->on_media_progress(std::min(media_done, media_total), media_total);
+		if (ctx && ctx->on_stages)
+		{
+			HlsStages running = stages;
+			running.output_wait_ms = sink.wait_ms;
+			running.total_ms = ms_since(t_begin);
+			running.add(ctx->stages);
+			ctx->on_stages(running);
+		}
+		if (!on_progress) return;
+
+		// once a few seconds are in, the bytes per media second so far
+		// predict the output size far better than the declared bitrate
+		if (media_total > 0.0 && media_done >= 2.0 && bytes_written > 0)
+			estimated_total_bytes = static_cast<long long>(bytes_written * (media_total / std::min(media_done, media_total)));
+
 		double total = static_cast<double>(estimated_total_bytes);
 		double current = static_cast<double>(bytes_written);
 		if (total > 0.0)
@@ -65,27 +443,105 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 		}
 	};
 
-	auto cleanup_ctx = [&]()
+	auto close_input = [&]()
 	{
 		if (in_ctx)
 		{
 			avformat_close_input(&in_ctx);
 			in_ctx = nullptr;
 		}
+		if (in_pb)
+		{
+			av_freep(&in_pb->buffer);
+			avio_context_free(&in_pb);
+		}
+		if (ctx)
+		{
+			if (fetcher) ctx->net_bytes += fetcher->net_bytes();
+			if (curl_in) ctx->net_bytes += curl_in->net_bytes();
+		}
+		fetcher.reset();
+		curl_in.reset();
+	};
+
+	auto cleanup_ctx = [&]()
+	{
+		close_input();
+		if (ctx)
+		{
+			stages.output_wait_ms = sink.wait_ms;
+			stages.total_ms = ms_since(t_begin);
+			ctx->stages.add(stages);
+			stages = HlsStages{};
+		}
 		if (out_ctx)
 		{
-			if (!(out_ctx->oformat->flags & AVFMT_NOFILE) && out_ctx->pb)
+			if (out_ctx->pb)
 			{
-				avio_closep(&out_ctx->pb);
+				avio_flush(out_ctx->pb);
+				av_freep(&out_ctx->pb->buffer);
+				avio_context_free(&out_ctx->pb);
 			}
 			avformat_free_context(out_ctx);
 			out_ctx = nullptr;
 		}
+		sink.finish();
+		if (sink.fp)
+		{
+			fclose(sink.fp);
+			sink.fp = nullptr;
+		}
 		if (in_opts)
 		{
 			av_dict_free(&in_opts);
 			in_opts = nullptr;
 		}
+		av_packet_free(&pkt);
+	};
+
+	// paused or cancelled from the queue. A pause keeps the segment cache in
+	// <out>.segs for the next run; a cancel drops it with the output.
+	auto stopped = [&]() -> bool
+	{
+		const bool cancel = ctx->control->load(std::memory_order_relaxed) == static_cast<int>(TransferControl::Cancel);
+		cleanup_ctx();
+		cleanup_tmp();
+		if (cancel)
+		{
+			std::error_code ec;
+			std::filesystem::remove_all(std::filesystem::u8path(out_path + ".segs"), ec);
+		}
+		msg = "stopped";
+		return false;
+	};
+
+	// the fetcher knows better than ffmpeg why the input ended early; call before cleanup_ctx
+	auto input_error = [&](const char* what, int err)
+	{
+		msg = std::string(what) + " failed: " + Helper::ff_errstr(err);
+		if (!ctx) return;
+		if (fetcher && !fetcher->error().empty())
+		{
+			msg += " (" + fetcher->error() + ")";
+			ctx->http_status = fetcher->http_status();
+			ctx->network_error = fetcher->network_error();
+		}
+		else if (curl_in && !curl_in->error().empty())
+		{
+			msg += " (" + curl_in->error() + ")";
+			ctx->http_status = curl_in->http_status();
+			ctx->network_error = curl_in->network_error();
+		}
+		else
+		{
+			ctx->http_status = http_status_of(err);
+			ctx->network_error = is_network_error(err);
+#if LIBAVFORMAT_VERSION_MAJOR < 59
+			// ffmpeg's own http client (see CurlInput) reports a dropped
+			// connection as a bare EIO; with the fetcher it is a disk read
+			if (err == AVERROR(EIO) && !fetcher) ctx->network_error = true;
+#endif
+		}
 	};
 
 	std::string header_block;
@@ -114,25 +570,111 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 		av_dict_set(&in_opts, "http_proxy", proxy.c_str(), 0);
 	}
 
-	int ret = avformat_open_input(&in_ctx, url.c_str(), nullptr, &in_opts);
-	if (ret < 0)
+	// Only for ffmpeg's own http client (libavformat < 59, see CurlInput):
+	// a stalled segment request must not hang the job, so time out after
+	// 30 s of silence and let the http protocol reconnect and resume.
+	av_dict_set(&in_opts, "rw_timeout", "30000000", 0);
+	av_dict_set(&in_opts, "reconnect", "1", 0);
+	av_dict_set(&in_opts, "reconnect_on_network_error", "1", 0);
+	av_dict_set(&in_opts, "reconnect_delay_max", "10", 0);
+
+	// Segments are fetched in parallel and fed to the demuxer in order;
+	// streams the fetcher cannot handle go through ffmpeg's hls demuxer.
+	auto open_input = [&](bool fast) -> int
 	{
-		cleanup_ctx();
-		cleanup_tmp();
-		msg = "avformat_open_input failed: " + Helper::ff_errstr(ret);
-		return false;
-	}
+		if (ctx && ctx->hls_segments > 1)
+		{
+			fetcher = std::make_unique<HlsFetcher>(url, extra_headers, proxy, ctx->hls_segments, ctx, out_path + ".segs");
+			std::string why;
+			if (fetcher->open(why))
+			{
+				if (fetcher->cached_segments())
+					std::cout << "[HLS] reusing " << fetcher->cached_segments() << "/" << fetcher->segments().size() << " cached segments" << std::endl;
+				const int io_size = 1 << 16;
+				auto* io_buf = static_cast<unsigned char*>(av_malloc(io_size));
+				in_pb = io_buf ? avio_alloc_context(io_buf, io_size, 0, fetcher.get(), &HlsFetcher::read_packet, nullptr, nullptr) : nullptr;
+				if (!in_pb) av_free(io_buf);
+			}
+			else
+			{
+				std::cout << "[HLS] native demuxer: " << why << std::endl;
+			}
+			if (!in_pb) fetcher.reset();
+		}
 
-	ret = avformat_find_stream_info(in_ctx, nullptr);
+		in_ctx = avformat_alloc_context();
+		if (in_ctx && ctx) in_ctx->interrupt_callback = { interrupt_cb, ctx };
+		if (in_ctx && in_pb)
+		{
+			in_ctx->pb = in_pb;
+			in_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+			fetcher->start();
+		}
+		else if (in_ctx)
+		{
+			// playlists, keys and segments (AES-128 ones included) go through
+			// curl instead of ffmpeg's http client; the hls demuxer's keep-alive
+			// reuse only knows the latter, so it is off while curl serves them
+			curl_in = std::make_unique<CurlInput>(extra_headers, proxy, ctx, out_path + ".segs");
+			if (curl_in->attach(in_ctx)) av_dict_set(&in_opts, "http_persistent", "0", 0);
+		}
+		if (in_ctx && fast)
+		{
+			in_ctx->probesize = kFastProbeSize;
+			in_ctx->max_analyze_duration = kFastAnalyzeDuration;
+		}
+
+		// avformat_open_input consumes the options it used; keep in_opts for a second open
+		AVDictionary* opts = nullptr;
+		av_dict_copy(&opts, in_opts, 0);
+		auto t0 = Clock::now();
+		int ret = avformat_open_input(&in_ctx, in_pb ? "" : url.c_str(), nullptr, &opts);
+		stages.open_ms += ms_since(t0);
+		av_dict_free(&opts);
+		if (ret < 0)
+		{
+			input_error("avformat_open_input", ret);
+			return ret;
+		}
+
+		t0 = Clock::now();
+		ret = avformat_find_stream_info(in_ctx, nullptr);
+		stages.probe_ms += ms_since(t0);
+		if (ret < 0) msg = "avformat_find_stream_info failed: " + Helper::ff_errstr(ret);
+		return ret;
+	};
+
+	// A rendition already probed in full for this course only needs a few
+	// packets read; the cached parameters supply what they leave unset.
+	ProbeCache* probe_cache = ctx && !ctx->probe_key.empty() ? ctx->probe_cache : nullptr;
+	bool fast_probe = probe_cache && probe_cache->contains(ctx->probe_key);
+
+	int ret = open_input(fast_probe);
+	if (ret >= 0 && fast_probe && !probe_cache->apply(ctx->probe_key, in_ctx))
+	{
+		std::cout << "[HLS] streams differ from the cached probe, probing in full" << std::endl;
+		probe_cache->drop(ctx->probe_key);
+		close_input();
+		fast_probe = false;
+		ret = open_input(false);
+	}
+	if (ret < 0 && ctx && ctx->stop_requested()) return stopped();
 	if (ret < 0)
 	{
 		cleanup_ctx();
 		cleanup_tmp();
-		msg = "avformat_find_stream_info failed: " + Helper::ff_errstr(ret);
 		return false;
 	}
+	if (fast_probe) ++stages.fast_probes;
+	else if (probe_cache) probe_cache->store(ctx->probe_key, in_ctx);
+	Clock::time_point t_stage;
 
-	double duration_seconds = (in_ctx->duration > 0) ? (double) in_ctx->duration / AV_TIME_BASE : 0.0;
+	// sum of #EXTINF: the fetcher parsed the playlist itself, the hls
+	// demuxer reports the same sum as the input duration
+	double duration_seconds = fetcher ? fetcher->duration() : 0.0;
+	if (duration_seconds <= 0.0 && in_ctx->duration > 0) duration_seconds = (double) in_ctx->duration / AV_TIME_BASE;
+	media_total = duration_seconds;
+	double start_seconds = in_ctx->start_time != AV_NOPTS_VALUE ? (double) in_ctx->start_time / AV_TIME_BASE : -1.0;
 	double bitrate_total = (in_ctx->bit_rate > 0) ? (double) in_ctx->bit_rate : 0.0;
 	if (bitrate_total <= 0.0)
 	{
@@ -152,7 +694,10 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 
 	report_progress(true);
 
-	ret = avformat_alloc_output_context2(&out_ctx, nullptr, "mpegts", tmp_path.c_str());
+	std::string container = container_name(ctx ? ctx->container : "ts");
+	if (container == "mp4" && duration_seconds <= 0.0) container = "fmp4";  // cannot size the moov
+
+	ret = avformat_alloc_output_context2(&out_ctx, nullptr, container == "ts" ? "mpegts" : "mp4", tmp_path.c_str());
 	if (ret < 0 || !out_ctx)
 	{
 		int err = ret < 0 ? ret : AVERROR_UNKNOWN;
@@ -162,9 +707,16 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 		return false;
 	}
 
+	// mp4 takes audio/video/subtitles only; HLS timed metadata (ID3) is dropped
+	std::vector<int> stream_map(in_ctx->nb_streams, -1);
 	for (unsigned int i = 0; i < in_ctx->nb_streams; ++i)
 	{
 		AVStream* in_stream = in_ctx->streams[i];
+		auto type = in_stream->codecpar->codec_type;
+		if (container != "ts" && type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_SUBTITLE)
+			continue;
+		stream_map[i] = static_cast<int>(out_ctx->nb_streams);
+
 		AVStream* out_stream = avformat_new_stream(out_ctx, nullptr);
 		if (!out_stream)
 		{
@@ -189,19 +741,77 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 		out_stream->sample_aspect_ratio = in_stream->sample_aspect_ratio;
 	}
 
+	// lecture captions become mov_text tracks of the mp4; mpegts cannot carry them
+	if (ctx)
+	{
+		for (auto& [lang, caption_url] : ctx->captions)
+		{
+			std::string why = "mpegts output";
+			CaptionTrack track;
+			track.lang = lang;
+			if (container != "ts" && load_caption(caption_url, extra_headers, proxy, ctx, track, why))
+			{
+				AVStream* out_stream = avformat_new_stream(out_ctx, nullptr);
+				if (out_stream && avcodec_parameters_copy(out_stream->codecpar, track.par) >= 0)
+				{
+					out_stream->time_base = AVRational{ 1, 1000 };
+					if (const char* iso = iso639_2(lang)) av_dict_set(&out_stream->metadata, "language", iso, 0);
+					av_dict_set(&out_stream->metadata, "handler_name", lang.c_str(), 0);
+					track.out_index = out_stream->index;
+					captions.push_back(std::move(track));
+					continue;
+				}
+				why = "avformat_new_stream failed";
+			}
+			if (ctx->stop_requested()) break;
+			std::cout << "[HLS] caption " << lang << " not embedded: " << why << std::endl;
+			ctx->captions_skipped.push_back(lang);
+		}
+	}
+
 	if (!(out_ctx->oformat->flags & AVFMT_NOFILE))
 	{
-		ret = avio_open(&out_ctx->pb, tmp_path.c_str(), AVIO_FLAG_WRITE);
-		if (ret < 0)
+		sink.fp = Helper::xfopen(tmp_path.c_str(), "wb");
+		if (!sink.fp)
 		{
 			cleanup_ctx();
 			cleanup_tmp();
-			msg = "avio_open failed: " + Helper::ff_errstr(ret);
+			msg = "cannot open file";
 			return false;
 		}
+		sink.start();
+
+		auto* io_buf = static_cast<unsigned char*>(av_malloc(kOutputBufferSize));
+		out_ctx->pb = io_buf
+			? avio_alloc_context(io_buf, kOutputBufferSize, 1, &sink, nullptr, sink_write, sink_seek)
+			: nullptr;
+		if (!out_ctx->pb)
+		{
+			av_free(io_buf);
+			cleanup_ctx();
+			cleanup_tmp();
+			msg = "avio_alloc_context failed";
+			return false;
+		}
+		out_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+
+	// neither mp4 flavour needs faststart's second pass over the finished file
+	AVDictionary* mux_opts = nullptr;
+	if (container == "fmp4")
+		av_dict_set(&mux_opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+	else if (container == "mp4")
+	{
+		// The moov is written into the reserved space at the end, over bytes
+		// already hashed, so a plain mp4 is always read back once for its
+		// digests; skip the inline hashing that would be thrown away.
+		// fmp4 only ever appends and keeps the single pass.
+		av_dict_set_int(&mux_opts, "moov_size", moov_reserve(in_ctx, duration_seconds), 0);
+		sink.sequential = false;
 	}
 
-	ret = avformat_write_header(out_ctx, nullptr);
+	ret = avformat_write_header(out_ctx, &mux_opts);
+	av_dict_free(&mux_opts);
 	if (ret < 0)
 	{
 		cleanup_ctx();
@@ -210,50 +820,115 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 		return false;
 	}
 
-	AVPacket pkt;
-	av_init_packet(&pkt);
+	// cues up to `upto` seconds into the stream, shifted onto the video's timeline
+	auto write_captions = [&](double upto)
+	{
+		const int64_t offset = std::llround(std::max(start_seconds, 0.0) * 1000.0);
+		for (auto& track : captions)
+		{
+			while (track.next < track.cues.size() && track.cues[track.next]->pts <= upto * 1000.0)
+			{
+				AVPacket* cue = track.cues[track.next++];
+				AVRational tb = out_ctx->streams[track.out_index]->time_base;
+				cue->stream_index = track.out_index;
+				cue->pts = cue->dts = av_rescale_q(cue->pts + offset, AVRational{ 1, 1000 }, tb);
+				cue->duration = av_rescale_q(cue->duration, AVRational{ 1, 1000 }, tb);
+				cue->pos = -1;
+				int ret = av_interleaved_write_frame(out_ctx, cue);
+				if (ret < 0) return ret;
+			}
+		}
+		return 0;
+	};
+
+	pkt = av_packet_alloc();
+	if (!pkt)
+	{
+		cleanup_ctx();
+		cleanup_tmp();
+		msg = "av_packet_alloc failed";
+		return false;
+	}
 	while (true)
 	{
-		ret = av_read_frame(in_ctx, &pkt);
+		if (ctx && ctx->stop_requested()) return stopped();
+
+		t_stage = Clock::now();
+		ret = av_read_frame(in_ctx, pkt);
+		stages.read_ms += ms_since(t_stage);
 		if (ret == AVERROR_EOF) break;
 		if (ret == AVERROR(EAGAIN))
 		{
-			av_packet_unref(&pkt);
+			av_packet_unref(pkt);
 			continue;
 		}
+		if (ret < 0 && ctx && ctx->stop_requested())
+		{
+			av_packet_unref(pkt);
+			return stopped();
+		}
 		if (ret < 0)
 		{
-			av_packet_unref(&pkt);
+			av_packet_unref(pkt);
+			input_error("av_read_frame", ret);
 			cleanup_ctx();
 			cleanup_tmp();
-			msg = "av_read_frame failed: " + Helper::ff_errstr(ret);
 			return false;
 		}
-		AVStream* in_stream = in_ctx->streams[pkt.stream_index];
-		AVStream* out_stream = out_ctx->streams[pkt.stream_index];
+		if (pkt->stream_index < 0 || pkt->stream_index >= static_cast<int>(stream_map.size()) || stream_map[pkt->stream_index] < 0)
+		{
+			av_packet_unref(pkt);
+			continue;
+		}
+		AVStream* in_stream = in_ctx->streams[pkt->stream_index];
+		pkt->stream_index = stream_map[pkt->stream_index];
 
-		if (pkt.pts != AV_NOPTS_VALUE)
+		if (pkt->pts != AV_NOPTS_VALUE)
 		{
-			pkt.pts = av_rescale_q_rnd(pkt.pts, in_stream->time_base, out_stream->time_base,
+			double tb = av_q2d(in_stream->time_base);
+			double t = pkt->pts * tb;
+			if (start_seconds < 0.0) start_seconds = t;
+			ret = write_captions(t - start_seconds);
+			if (ret < 0)
+			{
+				av_packet_unref(pkt);
+				cleanup_ctx();
+				cleanup_tmp();
+				msg = "caption write failed: " + Helper::ff_errstr(ret);
+				return false;
+			}
+			if (pkt->duration > 0) t += pkt->duration * tb;
+			if (t - start_seconds > media_done) media_done = t - start_seconds;
+		}
+		AVStream* out_stream = out_ctx->streams[pkt->stream_index];
+
+		if (pkt->pts != AV_NOPTS_VALUE)
+		{
+			pkt->pts = av_rescale_q_rnd(pkt->pts, in_stream->time_base, out_stream->time_base,
 									   (AVRounding) (AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
 		}
-		if (pkt.dts != AV_NOPTS_VALUE)
+		if (pkt->dts != AV_NOPTS_VALUE)
 		{
-			pkt.dts = av_rescale_q_rnd(pkt.dts, in_stream->time_base, out_stream->time_base,
+			pkt->dts = av_rescale_q_rnd(pkt->dts, in_stream->time_base, out_stream->time_base,
 									   (AVRounding) (AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
 		}
-		if (pkt.duration > 0)
+		if (pkt->duration > 0)
 		{
-			pkt.duration = av_rescale_q(pkt.duration, in_stream->time_base, out_stream->time_base);
+			pkt->duration = av_rescale_q(pkt->duration, in_stream->time_base, out_stream->time_base);
 		}
-		pkt.pos = -1;
+		pkt->pos = -1;
 
-		ret = av_interleaved_write_frame(out_ctx, &pkt);
-		if (ret >= 0 && pkt.size > 0)
+		const int pkt_size = pkt->size;  // the muxer takes the packet's data
+		t_stage = Clock::now();
+		ret = av_interleaved_write_frame(out_ctx, pkt);
+		stages.write_ms += ms_since(t_stage);
+		if (ret >= 0 && pkt_size > 0)
 		{
-			bytes_written += pkt.size;
+			bytes_written += pkt_size;
+			stages.packets += 1;
+			stages.bytes += pkt_size;
 		}
-		av_packet_unref(&pkt);
+		av_packet_unref(pkt);
 		if (ret < 0)
 		{
 			cleanup_ctx();
@@ -264,13 +939,23 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 
 		report_progress();
 	}
-	av_packet_unref(&pkt);
+	av_packet_unref(pkt);
+
+	ret = write_captions(std::numeric_limits<double>::infinity());
+	if (ret < 0)
+	{
+		cleanup_ctx();
+		cleanup_tmp();
+		msg = "caption write failed: " + Helper::ff_errstr(ret);
+		return false;
+	}
 
 	if (out_ctx && out_ctx->pb)
 	{
 		avio_flush(out_ctx->pb);
 	}
 
+	t_stage = Clock::now();
 	ret = av_write_trailer(out_ctx);
 	if (ret < 0)
 	{
@@ -279,6 +964,15 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 		msg = "av_write_trailer failed: " + Helper::ff_errstr(ret);
 		return false;
 	}
+	if (out_ctx->pb) avio_flush(out_ctx->pb);
+	if (!sink.finish())
+	{
+		cleanup_ctx();
+		cleanup_tmp();
+		msg = "write failed";
+		return false;
+	}
+	stages.finish_ms = ms_since(t_stage);
 
 	cleanup_ctx();
 
@@ -290,6 +984,25 @@ bool FFmpegHelper::convert_m3u8_to_ts(
 		msg = "rename failed";
 		return false;
 	}
+	std::filesystem::remove_all(std::filesystem::u8path(out_path + ".segs"), ec);
+
+	if (ctx)
+	{
+		if (sink.sequential)
+		{
+			ctx->xxh64 = sink.hasher.xxh64_hex();
+			ctx->sha256 = sink.hasher.sha256_hex();
+		}
+		else
+		{
+			// muxer patched the header after the fact; the inline digest is stale
+			std::string herr;
+			Checksum::hash_file(out_path, ctx->want_sha256, ctx->xxh64, ctx->sha256, herr);
+		}
+	}
+
+	if (ctx && ctx->on_media_progress && media_total > 0.0)
+		ctx->on_media_progress(media_total, media_total);
 
 	if (on_progress)
 	{
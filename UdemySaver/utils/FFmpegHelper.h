@@ -4,13 +4,23 @@
 #include <string>
 #include <vector>
 
+struct TransferContext;
+
 class FFmpegHelper {
 public:
+    // Remuxes an HLS stream into ctx->container (mpegts when there is no ctx).
     static bool convert_m3u8_to_ts(
         const std::string& url,
         const std::string& out_path,
         const std::vector<std::string>& extra_headers,
         const std::string& proxy,
         std::function<void(double, double)> on_progress,
-        std::string& msg);
+        std::string& msg,
+        TransferContext* ctx = nullptr);
+
+    // HLS output containers: "ts" (mpegts), "mp4" (moov space reserved up
+    // front, written in one pass) and "fmp4" (fragmented mp4). Unknown
+    // names map to "ts".
+    static std::string container_name(const std::string& s);
+    static const char* container_extension(const std::string& container);
 };
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "HlsFetcher.h"
+
+#include "Helper.h"
+#include "TransferContext.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+namespace {
+	constexpr int kSegmentAttempts = 4;
+	constexpr size_t kWindowPerThread = 2;  // reorder buffer: segments ahead of the reader per thread
+	constexpr const char* kUserAgent = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36";
+
+	int abort_cb(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+		auto* ctx = static_cast<const TransferContext*>(clientp);
+		return ctx && ctx->stop_requested() ? 1 : 0;
+	}
+
+	struct Easy {
+		CURL* h = curl_easy_init();
+		curl_slist* hdr = nullptr;
+		~Easy() {
+			if (hdr) curl_slist_free_all(hdr);
+			if (h) curl_easy_cleanup(h);
+		}
+	};
+
+	void setup(Easy& e, const std::vector<std::string>& headers, const std::string& proxy, const TransferContext* ctx) {
+		for (auto& h : headers) e.hdr = curl_slist_append(e.hdr, h.c_str());
+		curl_easy_setopt(e.h, CURLOPT_HTTPHEADER, e.hdr);
+		curl_easy_setopt(e.h, CURLOPT_USERAGENT, kUserAgent);
+		curl_easy_setopt(e.h, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(e.h, CURLOPT_MAXREDIRS, 8L);
+		curl_easy_setopt(e.h, CURLOPT_FAILONERROR, 1L);
+		curl_easy_setopt(e.h, CURLOPT_CONNECTTIMEOUT_MS, 8000L);
+		// a silent segment is dropped after 30 s and fetched again
+		curl_easy_setopt(e.h, CURLOPT_LOW_SPEED_LIMIT, 1L);
+		curl_easy_setopt(e.h, CURLOPT_LOW_SPEED_TIME, 30L);
+		curl_easy_setopt(e.h, CURLOPT_WRITEFUNCTION, Helper::write_to_string);
+		curl_easy_setopt(e.h, CURLOPT_NOPROGRESS, 0L);
+		curl_easy_setopt(e.h, CURLOPT_XFERINFOFUNCTION, abort_cb);
+		curl_easy_setopt(e.h, CURLOPT_XFERINFODATA, ctx);
+		if (!proxy.empty()) curl_easy_setopt(e.h, CURLOPT_PROXY, proxy.c_str());
+	}
+
+	bool get(Easy& e, const std::string& url, std::string& body, long& code, CURLcode& rc) {
+		body.clear();
+		code = 0;
+		curl_easy_setopt(e.h, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(e.h, CURLOPT_WRITEDATA, &body);
+		rc = curl_easy_perform(e.h);
+		curl_easy_getinfo(e.h, CURLINFO_RESPONSE_CODE, &code);
+		return rc == CURLE_OK;
+	}
+
+	std::string resolve_url(const std::string& base, const std::string& ref) {
+		if (ref.find("://") != std::string::npos) return ref;
+		std::string path = base.substr(0, base.find_first_of("?#"));
+		if (!ref.empty() && ref[0] == '/')
+		{
+			auto host_end = path.find('/', path.find("://") + 3);
+			return path.substr(0, host_end) + ref;
+		}
+		return path.substr(0, path.rfind('/') + 1) + ref;
+	}
+
+	std::string attr(const std::string& line, const char* key) {
+		auto pos = line.find(key);
+		if (pos == std::string::npos) return {};
+		pos += std::strlen(key);
+		auto end = line.find(',', pos);
+		return line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+	}
+}
+
+HlsFetcher::HlsFetcher(std::string url, std::vector<std::string> headers, std::string proxy,
+	int parallel, const TransferContext* ctx, std::string cache_dir)
+	: url_(std::move(url)), headers_(std::move(headers)), proxy_(std::move(proxy)),
+	parallel_(std::max(1, parallel)), ctx_(ctx), cache_(std::move(cache_dir)) {
+}
+
+HlsFetcher::~HlsFetcher() {
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (auto& t : threads_) if (t.joinable()) t.join();
+}
+
+bool HlsFetcher::open(std::string& err) {
+	Easy e;
+	if (!e.h) { err = "curl init failed"; return false; }
+	setup(e, headers_, proxy_, ctx_);
+
+	std::string url = url_;
+	for (int level = 0; level < 2; ++level)
+	{
+		std::string text;
+		long code = 0;
+		CURLcode rc = CURLE_OK;
+		if (!get(e, url, text, code, rc))
+		{
+			err = code >= 400 ? "playlist http " + std::to_string(code) : std::string("playlist: ") + curl_easy_strerror(rc);
+			return false;
+		}
+
+		std::istringstream in(text);
+		std::string line, variant;
+		long best_bw = -1;
+		double extinf = 0.0;
+		bool stream_inf = false;
+		segments_.clear();
+
+		while (std::getline(in, line))
+		{
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (line.empty()) continue;
+
+			if (line.rfind("#EXT-X-STREAM-INF", 0) == 0)
+			{
+				long bw = std::atol(attr(line, "BANDWIDTH=").c_str());
+				stream_inf = true;
+				if (bw > best_bw) { best_bw = bw; variant.clear(); }
+				else stream_inf = false;  // keep the best one only
+				continue;
+			}
+			if (line.rfind("#EXT-X-KEY", 0) == 0 && line.find("METHOD=NONE") == std::string::npos)
+			{
+				err = "encrypted playlist";
+				return false;
+			}
+			if (line.rfind("#EXT-X-MAP", 0) == 0) { err = "fmp4 init section"; return false; }
+			if (line.rfind("#EXT-X-BYTERANGE", 0) == 0) { err = "byte-range segments"; return false; }
+			if (line.rfind("#EXTINF:", 0) == 0)
+			{
+				extinf = std::atof(line.c_str() + 8);
+				continue;
+			}
+			if (line[0] == '#') continue;
+
+			if (stream_inf)
+			{
+				variant = resolve_url(url, line);
+				stream_inf = false;
+			}
+			else if (best_bw < 0)
+			{
+				segments_.push_back({ resolve_url(url, line), extinf });
+				extinf = 0.0;
+			}
+		}
+
+		if (best_bw < 0) break;  // media playlist
+		if (variant.empty()) { err = "empty master playlist"; return false; }
+		url = variant;
+	}
+
+	if (segments_.empty()) { err = "no segments"; return false; }
+
+	// segments an earlier attempt left in the cache, by either download path
+	cached_.assign(segments_.size(), 0);
+	cached_count_ = 0;
+	for (size_t i = 0; i < segments_.size(); ++i)
+	{
+		if (!cache_.contains(segments_[i].url)) continue;
+		cached_[i] = 1;
+		++cached_count_;
+	}
+	return true;
+}
+
+void HlsFetcher::start() {
+	int n = std::min<int>(parallel_, static_cast<int>(segments_.size()));
+	for (int i = 0; i < n; ++i) threads_.emplace_back([this] { fetch_loop(); });
+}
+
+double HlsFetcher::duration() const {
+	double d = 0.0;
+	for (auto& s : segments_) d += s.duration;
+	return d;
+}
+
+void HlsFetcher::fetch_loop() {
+	Easy e;
+	if (e.h) setup(e, headers_, proxy_, ctx_);
+	const size_t window = kWindowPerThread * static_cast<size_t>(parallel_);
+
+	while (true)
+	{
+		size_t idx = 0;
+		{
+			std::unique_lock<std::mutex> lk(mtx_);
+			cv_.wait(lk, [&] { return stop_ || failed_ || next_fetch_ >= segments_.size() || next_fetch_ < next_read_ + window; });
+			if (stop_ || failed_ || next_fetch_ >= segments_.size()) return;
+			idx = next_fetch_++;
+		}
+
+		std::string body;
+		long code = 0;
+		CURLcode rc = e.h ? CURLE_OK : CURLE_FAILED_INIT;
+		bool ok = cached_[idx] && cache_.read(segments_[idx].url, {}, body);
+		const bool from_cache = ok;
+		for (int attempt = 0; !ok && e.h && attempt < kSegmentAttempts; ++attempt)
+		{
+			if (attempt > 0)
+			{
+				// back off a little and come back on a new connection
+				std::unique_lock<std::mutex> lk(mtx_);
+				if (cv_.wait_for(lk, std::chrono::seconds(attempt), [&] { return stop_; })) return;
+				curl_easy_setopt(e.h, CURLOPT_FRESH_CONNECT, 1L);
+			}
+			ok = get(e, segments_[idx].url, body, code, rc);
+			curl_easy_setopt(e.h, CURLOPT_FRESH_CONNECT, 0L);
+			curl_off_t got = 0;
+			if (curl_easy_getinfo(e.h, CURLINFO_SIZE_DOWNLOAD_T, &got) == CURLE_OK) net_bytes_ += got;
+			if (ok || rc == CURLE_ABORTED_BY_CALLBACK) break;
+			if (code >= 400 && code < 500 && code != 408 && code != 429) break;  // retrying will not help
+		}
+
+		if (ok && !from_cache) cache_.store(segments_[idx].url, {}, body);
+
+		std::lock_guard<std::mutex> lk(mtx_);
+		if (ok)
+		{
+			ready_[idx] = std::move(body);
+		}
+		else if (!failed_)
+		{
+			failed_ = true;
+			http_status_ = code >= 400 ? code : 0;
+			network_error_ = http_status_ == 0 && rc != CURLE_ABORTED_BY_CALLBACK;
+			error_ = "segment " + std::to_string(idx) + ": " +
+				(http_status_ ? "http " + std::to_string(http_status_) : std::string(curl_easy_strerror(rc)));
+		}
+		cv_.notify_all();
+	}
+}
+
+int HlsFetcher::read_packet(void* opaque, uint8_t* buf, int buf_size) {
+	return static_cast<HlsFetcher*>(opaque)->read(buf, buf_size);
+}
+
+int HlsFetcher::read(uint8_t* buf, int size) {
+	std::unique_lock<std::mutex> lk(mtx_);
+	while (true)
+	{
+		if (ctx_ && ctx_->stop_requested()) return AVERROR_EXIT;
+		if (next_read_ >= segments_.size()) return AVERROR_EOF;
+
+		auto it = ready_.find(next_read_);
+		if (it != ready_.end())
+		{
+			const std::string& seg = it->second;
+			size_t n = std::min(static_cast<size_t>(size), seg.size() - read_off_);
+			std::memcpy(buf, seg.data() + read_off_, n);
+			read_off_ += n;
+			if (read_off_ >= seg.size())
+			{
+				ready_.erase(it);
+				++next_read_;
+				read_off_ = 0;
+				cv_.notify_all();  // window moved
+			}
+			if (n > 0) return static_cast<int>(n);
+			continue;
+		}
+		if (failed_) return AVERROR(EIO);
+
+		// short timeout so a pause/cancel request is seen while waiting
+		cv_.wait_for(lk, std::chrono::milliseconds(100));
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SegmentCache.h"
+
+struct TransferContext;
+
+// Parallel HLS download. Parses the media playlist, fetches up to N
+// segments at once (each fetch thread keeps one curl handle, so its
+// connection is reused) and hands the bytes out strictly in playlist order
+// through read_packet, which backs the custom AVIOContext of the remuxer.
+// Segments more than a small window ahead of the reader are not fetched,
+// so memory stays bounded by a few segments.
+//
+// With a cache directory every fetched segment is also kept in a
+// SegmentCache; a later attempt reads those segments back instead of
+// downloading them again, whether it runs here or through CurlInput.
+class HlsFetcher {
+public:
+    struct Segment {
+        std::string url;
+        double duration = 0.0;  // EXTINF, seconds
+    };
+
+    HlsFetcher(std::string url, std::vector<std::string> headers, std::string proxy,
+               int parallel, const TransferContext* ctx = nullptr, std::string cache_dir = {});
+    ~HlsFetcher();
+    HlsFetcher(const HlsFetcher&) = delete;
+    HlsFetcher& operator=(const HlsFetcher&) = delete;
+
+    // Downloads and parses the playlist (a master playlist is followed to
+    // its highest-bandwidth variant). False when the stream needs ffmpeg's
+    // own demuxer (encryption, fMP4 init sections, byte ranges) or the
+    // playlist could not be fetched; `err` says why.
+    bool open(std::string& err);
+    void start();
+
+    // AVIOContext read callback; opaque is the HlsFetcher
+    static int read_packet(void* opaque, uint8_t* buf, int buf_size);
+
+    const std::vector<Segment>& segments() const { return segments_; }
+    double duration() const;
+    size_t cached_segments() const { return cached_count_; }  // reused from an earlier attempt
+    long long net_bytes() const { return net_bytes_.load(std::memory_order_relaxed); }
+
+    // why the stream ended early, valid once read_packet returned an error
+    long http_status() const { return http_status_; }
+    bool network_error() const { return network_error_; }
+    const std::string& error() const { return error_; }
+
+private:
+    void fetch_loop();
+    int read(uint8_t* buf, int size);
+
+    std::string url_;
+    std::vector<std::string> headers_;
+    std::string proxy_;
+    int parallel_;
+    const TransferContext* ctx_;
+    SegmentCache cache_;
+
+    std::vector<Segment> segments_;
+    std::vector<char> cached_;             // segment is in cache_ since open()
+    size_t cached_count_ = 0;
+    std::atomic<long long> net_bytes_{ 0 };
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::map<size_t, std::string> ready_;  // reorder buffer, segment index -> bytes
+    size_t next_fetch_ = 0;                // next segment to hand to a fetch thread
+    size_t next_read_ = 0;                 // segment the reader is on
+    size_t read_off_ = 0;
+    bool stop_ = false;
+    bool failed_ = false;
+    long http_status_ = 0;
+    bool network_error_ = false;
+    std::string error_;
+    std::vector<std::thread> threads_;
+};
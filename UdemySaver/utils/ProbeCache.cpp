@@ -0,0 +1,87 @@
+#include "ProbeCache.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+namespace {
+	constexpr size_t kMaxEntries = 64;
+
+	// what a short probe may leave out that the muxer wants
+	bool incomplete(const AVCodecParameters* par, const AVCodecParameters* full) {
+		if (par->format < 0 && full->format >= 0) return true;
+		if (par->extradata_size <= 0 && full->extradata_size > 0) return true;
+		return par->codec_type == AVMEDIA_TYPE_AUDIO && par->sample_rate <= 0;
+	}
+}
+
+void ProbeCache::ParDeleter::operator()(AVCodecParameters* p) const {
+	avcodec_parameters_free(&p);
+}
+
+void ProbeCache::store(const std::string& key, const AVFormatContext* in) {
+	if (key.empty() || !in || in->nb_streams == 0) return;
+
+	std::vector<Stream> streams;
+	streams.reserve(in->nb_streams);
+	for (unsigned int i = 0; i < in->nb_streams; ++i)
+	{
+		const AVStream* st = in->streams[i];
+		Stream s;
+		s.par.reset(avcodec_parameters_alloc());
+		if (!s.par || avcodec_parameters_copy(s.par.get(), st->codecpar) < 0) return;
+		s.fps_num = st->avg_frame_rate.num;
+		s.fps_den = st->avg_frame_rate.den;
+		streams.push_back(std::move(s));
+	}
+
+	std::lock_guard<std::mutex> lk(mtx_);
+	if (!entries_.count(key)) order_.push_back(key);
+	entries_[key] = std::move(streams);
+	while (order_.size() > kMaxEntries)
+	{
+		entries_.erase(order_.front());
+		order_.pop_front();
+	}
+}
+
+bool ProbeCache::contains(const std::string& key) const {
+	std::lock_guard<std::mutex> lk(mtx_);
+	return entries_.count(key) != 0;
+}
+
+bool ProbeCache::apply(const std::string& key, AVFormatContext* in) const {
+	std::lock_guard<std::mutex> lk(mtx_);
+	auto it = entries_.find(key);
+	if (it == entries_.end() || !in || in->nb_streams != it->second.size()) return false;
+	const auto& streams = it->second;
+
+	for (unsigned int i = 0; i < in->nb_streams; ++i)
+	{
+		const AVCodecParameters* par = in->streams[i]->codecpar;
+		const AVCodecParameters* full = streams[i].par.get();
+		if (par->codec_type != full->codec_type || par->codec_id != full->codec_id) return false;
+		// the first keyframe carries the SPS, so a short probe knows the
+		// size; another size is another rendition under the same key
+		if (par->codec_type == AVMEDIA_TYPE_VIDEO && (par->width != full->width || par->height != full->height)) return false;
+		if (par->codec_type == AVMEDIA_TYPE_AUDIO && par->sample_rate > 0 && par->sample_rate != full->sample_rate) return false;
+	}
+
+	for (unsigned int i = 0; i < in->nb_streams; ++i)
+	{
+		AVStream* st = in->streams[i];
+		const Stream& s = streams[i];
+		if (incomplete(st->codecpar, s.par.get()) && avcodec_parameters_copy(st->codecpar, s.par.get()) < 0) return false;
+		if (st->avg_frame_rate.num <= 0 && s.fps_num > 0) st->avg_frame_rate = AVRational{ s.fps_num, s.fps_den };
+	}
+	return true;
+}
+
+void ProbeCache::drop(const std::string& key) {
+	std::lock_guard<std::mutex> lk(mtx_);
+	if (!entries_.erase(key)) return;
+	order_.erase(std::remove(order_.begin(), order_.end(), key), order_.end());
+}
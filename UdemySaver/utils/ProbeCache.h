@@ -0,0 +1,43 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct AVCodecParameters;
+struct AVFormatContext;
+
+// Stream parameters of HLS renditions that were probed in full, keyed by
+// course and rendition. The lectures of a course share one encoding ladder,
+// so the next lecture of the same rendition opens with a short probe and
+// takes what that probe left unset (frame rate, sample format, extradata)
+// from here. Thread safe; shared by all queue workers.
+class ProbeCache {
+public:
+    // after a full avformat_find_stream_info
+    void store(const std::string& key, const AVFormatContext* in);
+    bool contains(const std::string& key) const;
+
+    // Checks a short-probed input against the entry and fills in the rest.
+    // False, leaving `in` untouched, when there is no entry or the streams
+    // differ (count, codecs, resolution, sample rate): probe in full then.
+    bool apply(const std::string& key, AVFormatContext* in) const;
+    void drop(const std::string& key);
+
+private:
+    struct ParDeleter {
+        void operator()(AVCodecParameters* p) const;
+    };
+    struct Stream {
+        std::unique_ptr<AVCodecParameters, ParDeleter> par;
+        int fps_num = 0;
+        int fps_den = 0;
+    };
+
+    mutable std::mutex mtx_;
+    std::map<std::string, std::vector<Stream>> entries_;
+    std::deque<std::string> order_;  // oldest first, bounds the cache
+};
@@ -0,0 +1,51 @@
+#include "SegmentCache.h"
+
+#include "Checksum.h"
+#include "Helper.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+std::string SegmentCache::path(const std::string& url, const std::string& range) const {
+	const std::string key = url.substr(0, url.find_first_of("?#")) + "|" + range;
+	Checksum::Xxh64 h;
+	h.update(key.data(), key.size());
+	return dir_ + "/n-" + h.hex() + ".bin";
+}
+
+bool SegmentCache::contains(const std::string& url, const std::string& range) const {
+	if (dir_.empty()) return false;
+	std::error_code ec;
+	auto sz = std::filesystem::file_size(std::filesystem::u8path(path(url, range)), ec);
+	return !ec && sz > 0;
+}
+
+bool SegmentCache::read(const std::string& url, const std::string& range, std::string& body) const {
+	if (dir_.empty()) return false;
+	FILE* fp = Helper::xfopen(path(url, range).c_str(), "rb");
+	if (!fp) return false;
+	body.clear();
+	char buf[1 << 16];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) body.append(buf, n);
+	bool ok = !ferror(fp);
+	fclose(fp);
+	return ok && !body.empty();
+}
+
+void SegmentCache::store(const std::string& url, const std::string& range, const std::string& body) {
+	if (dir_.empty() || body.empty()) return;
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	std::call_once(made_, [&] { fs::create_directories(fs::u8path(dir_), ec); });
+
+	const std::string dst = path(url, range);
+	const std::string tmp = dst + ".tmp";
+	FILE* fp = Helper::xfopen(tmp.c_str(), "wb");
+	if (!fp) return;
+	bool ok = fwrite(body.data(), 1, body.size(), fp) == body.size();
+	ok = fclose(fp) == 0 && ok;
+	if (ok) fs::rename(fs::u8path(tmp), fs::u8path(dst), ec);
+	if (!ok || ec) fs::remove(fs::u8path(tmp), ec);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <utility>
+
+// On-disk cache of the HLS segments and keys of one lecture, shared by both
+// download paths (HlsFetcher and CurlInput) so a retry that lands on the
+// other path still finds what was fetched. One file per url path and byte
+// range; the query is left out, so a re-signed url maps to the same file.
+// Files are written under a temporary name and renamed, so a torn write is
+// never read back. Safe to use from several fetch threads.
+class SegmentCache {
+public:
+    explicit SegmentCache(std::string dir = {}) : dir_(std::move(dir)) {}
+
+    bool enabled() const { return !dir_.empty(); }
+    bool contains(const std::string& url, const std::string& range = {}) const;
+    bool read(const std::string& url, const std::string& range, std::string& body) const;
+    void store(const std::string& url, const std::string& range, const std::string& body);
+
+private:
+    std::string path(const std::string& url, const std::string& range) const;
+
+    std::string dir_;
+    std::once_flag made_;
+};
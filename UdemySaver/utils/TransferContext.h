@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef void CURL;
+class ProbeCache;
+
+// Where an HLS remux spent its time, milliseconds; filled by FFmpegHelper.
+struct HlsStages {
+    double open_ms = 0.0;         // avformat_open_input: playlist and first reads
+    double probe_ms = 0.0;        // avformat_find_stream_info
+    double read_ms = 0.0;         // inside av_read_frame, mostly waiting for input
+    double write_ms = 0.0;        // inside av_interleaved_write_frame
+    double output_wait_ms = 0.0;  // part of write_ms blocked on the full write-behind queue
+    double finish_ms = 0.0;       // trailer and draining the output
+    double total_ms = 0.0;
+    long long packets = 0;
+    long long bytes = 0;
+    long long fast_probes = 0;    // inputs opened with a short probe from the ProbeCache
+
+    void add(const HlsStages& o) {
+        open_ms += o.open_ms;
+        probe_ms += o.probe_ms;
+        read_ms += o.read_ms;
+        write_ms += o.write_ms;
+        output_wait_ms += o.output_wait_ms;
+        finish_ms += o.finish_ms;
+        total_ms += o.total_ms;
+        packets += o.packets;
+        bytes += o.bytes;
+        fast_probes += o.fast_probes;
+    }
+};
+
+// Requests from the queue to a running transfer.
+enum class TransferControl : int { Run = 0, Pause, Cancel };
+
+// Per-transfer state shared between the queue worker and the download
+// routines (curl_download_file / FFmpegHelper). Inputs are set by the
+// worker before the transfer starts, outputs are filled by the transfer.
+struct TransferContext {
+    // in
+    bool want_sha256 = false;
+
+    // in: TransferControl, flipped by the queue while the transfer runs and
+    // polled by the curl progress callback / FFmpeg interrupt callback.
+    // A stopped transfer returns false and leaves its .part in place.
+    const std::atomic<int>* control = nullptr;
+
+    // in: small-file lane; shares DNS/TLS sessions with the other lane workers
+    // and runs on the worker's own curl handle (`easy`), whose connection
+    // stays open across jobs. nullptr = a handle per transfer.
+    bool small_lane = false;
+    CURL* easy = nullptr;
+
+    // in: HLS segments fetched in parallel; 1 leaves it to ffmpeg's hls demuxer
+    int hls_segments = 1;
+    std::string container = "ts";  // HLS output, see FFmpegHelper::container_name
+
+    // in: stream parameters of earlier lectures; probe_key names the course
+    // and rendition, empty = always probe in full
+    ProbeCache* probe_cache = nullptr;
+    std::string probe_key;
+
+    // in: caption files (language, url) muxed into an mp4/fmp4 HLS output as
+    // mov_text tracks; out: languages that could not be embedded
+    std::vector<std::pair<std::string, std::string>> captions;
+    std::vector<std::string> captions_skipped;
+
+    // in: HLS time progress, (seconds remuxed, playlist duration); called
+    // alongside the byte progress callback
+    std::function<void(double, double)> on_media_progress;
+
+    // in: HLS stage timings so far, url refreshes included (what `stages`
+    // will hold at the end); called alongside on_media_progress
+    std::function<void(const HlsStages&)> on_stages;
+
+    // out: digests of the final file, computed while it is written
+    std::string xxh64;
+    std::string sha256;
+
+    // out: HTTP status when the server refused the request, 0 otherwise.
+    // Nothing from an error response is written, so the .part stays resumable.
+    long http_status = 0;
+    long retry_after = 0;      // seconds, from a 429/503 Retry-After header
+
+    // out: the failure happened on the wire (dns, connect, reset, timeout,
+    // stall) rather than in the data or on disk, so a later retry may work
+    bool network_error = false;
+
+    // in/out: stall handling, carried across reconnects of one job
+    int reconnects = 0;
+    double typical_bps = 0.0;  // best rate sustained over a 10 s window
+    std::string edge_ip;       // server address of the last connection
+    long long net_bytes = 0;   // received on the wire, refetches included
+    HlsStages stages;          // out, summed across url refreshes like net_bytes
+
+    bool stop_requested() const {
+        return control && control->load(std::memory_order_relaxed) != static_cast<int>(TransferControl::Run);
+    }
+
+    // 401/403/410 from the CDN: the signed url expired, a fresh one may resume
+    bool url_rejected() const {
+        return http_status == 401 || http_status == 403 || http_status == 410;
+    }
+};
@@ -131,22 +131,6 @@ return url;
 }
 function fmtBytes(b){ if(!isFinite(b)||b<=0) return ''; const KB=1024, MB=KB*1024, GB=MB*1024; if(b>=GB) return (b/GB).toFixed(2)+' GB'; if(b>=MB) return (b/MB).toFixed(1)+' MB'; if(b>=KB) return Math.round(b/KB)+' KB'; return b+' B'; }
 function clamp01(x){ return Math.max(0, Math.min(1, x)); }
-const pad3 = n => String(n).padStart(3,'0');
-const safe = s => (s||"").toLowerCase().replace(/[^\p{L}\p{N}]+/gu,'-').replace(/-+/g,'-').replace(/^-|-$/g,'').slice(0,60) || 'item';
-function sanitizeFilename(name, fallback = 'item'){
-    const raw = (name||"").trim();
-    if(!raw) return fallback;
-    const lastDot = raw.lastIndexOf('.');
-    if(lastDot > 0 && lastDot < raw.length-1){
-        const base = safe(raw.slice(0,lastDot));
-        const ext = safe(raw.slice(lastDot+1));
-        if(base && ext) return `${base}.${ext}`;
-        if(base) return base;
-        if(ext) return `${fallback}.${ext}`;
-    }
-    const slug = safe(raw);
-    return slug || fallback;
-}
 function preferredQuality(){ return localStorage.getItem('cf_quality_pref') || '720'; }
 function updateQualityPill(){ if(qualityPill) qualityPill.textContent = t('quality.label', {q: preferredQuality()}); }
 
@@ -331,140 +315,32 @@ url = `/lectures?course_id=${courseId}&page=${page}`;
 return all;
 }
 
-/* ===== pick source ===== */
-function pickVideoSource(asset, preference="720"){
-if(!asset) return null;
-if(asset.download_urls && asset.download_urls.Video && asset.download_urls.Video.length){
-return {type:'mp4', label:'download', url:asset.download_urls.Video[0].file};
-}
-const list = (asset.stream_urls && asset.stream_urls.Video) ? asset.stream_urls.Video : [];
-const mp4s = list
-    .filter(x=>x && x.type==='video/mp4' && x.file)
-    .map(x=>({raw:x, quality:parseInt(x.label,10)||0}));
-mp4s.sort((a,b)=>a.quality-b.quality);
-const lowestMp4 = mp4s.length ? mp4s[0] : null;
-const bestMp4 = mp4s.length ? mp4s[mp4s.length-1] : null;
-
-const buildHls = ()=>{
-    const hlsEntry = list.find(x=>x && x.type==='application/x-mpegURL' && x.file);
-    if(hlsEntry) return {type:'hls', label:hlsEntry.label||'Auto', url:hlsEntry.file};
-    if(asset.hls_url) return {type:'hls', label:'Auto', url:asset.hls_url};
-    if(Array.isArray(asset.media_sources)){
-        for(const m of asset.media_sources){
-            if(!m) continue;
-            const src = m.src || m.file || m.url;
-            if(src) return {type:'hls', label:m.label||m.quality||'Auto', url:src};
-        }
-    }
-    return null;
-};
-
-const hlsSource = buildHls();
-const prefValue = /^\d+$/.test(preference) ? parseInt(preference,10) : null;
-const highestMp4 = bestMp4 ? bestMp4.quality : 0;
-let preferHls = false;
-if(hlsSource){
-    if(preference==='Highest') preferHls = true;
-    else if(prefValue && (prefValue >= 1080 || (highestMp4>0 && prefValue>highestMp4))) preferHls = true;
-}
-
-if(preferHls && hlsSource) return hlsSource;
-if(mp4s.length){
-    let chosen = bestMp4;
-    if(preference==='Lowest' && lowestMp4) chosen = lowestMp4;
-    else if(prefValue){
-        const exact = mp4s.find(x=>x.quality===prefValue) || mp4s.find(x=>String(x.raw.label)===String(preference));
-        if(exact) chosen = exact;
-        else{
-            const higherOrEqual = mp4s.find(x=>x.quality>=prefValue);
-            if(higherOrEqual) chosen = higherOrEqual;
-        }
-    }
-    return {type:'mp4', label:chosen.raw.label, url:chosen.raw.file};
-}
-
-if(hlsSource) return hlsSource;
-return null;
-}
-
 /* ===== enqueue ===== */
-async function enqueueLecture(course, lecture, idxInCourse, pref="720", opts={}){ 
-const asset = lecture && lecture.asset; 
-if(!asset || asset.asset_type!=='Video') return {skipped:true}; 
-const picked = pickVideoSource(asset, pref); 
-if(!picked) return {skipped:true}; 
-
-const base = { 
-course_id:course.id, course_title:course.title, 
-section_index:lecture.section_index||0, section_title:lecture.section_title||'', 
-lecture_index:idxInCourse, lecture_title:lecture.title||'', 
-lecture_id: lecture.id 
-}; 
-
-const videoPayload = {...base, url:picked.url, filename:`${pad3(idxInCourse)} - ${safe(lecture.title)}-${picked.label}.mp4`}; 
-let r = await fetch('/queue',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(videoPayload)}); 
-let data = await r.json().catch(()=>({ok:false}));
-if(data.skipped){
-    if(data.reason==='exists') toast(t('toast.exists',{title: lecture.title}));
-    else if(data.reason==='queued') toast(t('toast.queued',{title: lecture.title}));
-}
-
-if(opts.subs && Array.isArray(asset.captions)){ 
-for(const cap of asset.captions){ 
-const url = cap.url || cap.file || cap.src; if(!url) continue; 
-const lang = safe(cap.language || cap.label || 'sub'); 
-const ext = (url.split(/[#?]/)[0].split('.').pop()||'vtt'); 
-const p = {...base, url, filename:`${pad3(idxInCourse)} - ${safe(lecture.title)}.${lang}.${ext}`}; 
-await fetch('/queue',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(p)}); 
-} 
-} 
-
-if(opts.assets && Array.isArray(lecture.supplementary_assets)){
-for(const a of lecture.supplementary_assets){
-const name = a.filename ? a.filename : `${safe(a.title||'asset')}`;
-let url = '';
-if(a.download_urls){
-for(const k in a.download_urls){
-const arr = a.download_urls[k];
-if(Array.isArray(arr) && arr.length){
-url = arr[0].file || arr[0].url || '';
-if(url) break;
-}
-}
-}
-if(!url) continue;
-const p = {...base, filename:`${pad3(idxInCourse)} - ${safe(lecture.title)} - ${sanitizeFilename(name)}`, asset_id:a.id, url};
-await fetch('/queue',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(p)});
-}
-}
-return data; 
-}
-
+// the server walks the curriculum and queues each page as it arrives; we only follow its progress
 async function queueWholeCourse(course, preference="720"){ 
 const opts = {subs: userOpts.subs, assets: userOpts.assets};
 showBusy('queue.collecting'); 
 try{ 
 toast(t('toast.collecting',{title: course.title||'Course'})); 
-let page=1, knownTotal=null, seen=0, added=0, skipped=0, exists=0; 
+const r = await fetch('/course/download',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify({course_id:course.id, course_title:course.title, quality:preference, subs:opts.subs, assets:opts.assets})}); 
+const start = await r.json().catch(()=>({ok:false})); 
+if(!start.ok){ toast(start.error||'error'); return; } 
+let feed = null; 
 while(true){ 
-const j = await getJSON(`/lectures?course_id=${course.id}&page=${page}`); 
-if(knownTotal==null) knownTotal = (j && Number.isFinite(j.count)) ? (j.count|0) : null; 
-const chunk = Array.isArray(j.results) ? j.results : []; 
-if(chunk.length===0) break; 
-for(const lec of chunk){ 
-seen++; setBusyTextTextual(`${seen}/${knownTotal ?? '…'}`); 
-if(!lec || !lec.asset || lec.asset.asset_type!=='Video'){ skipped++; continue; } 
-const res = await enqueueLecture(course, lec, seen, preference, opts); 
-if(res && res.skipped && res.reason==='exists') exists++; 
-else if(res && res.ok) added++; 
-else skipped++; 
-if(seen%8===0) qTick(true); 
-} 
-if(j.next) page++; else break; 
+await new Promise(res=>setTimeout(res, 1000)); 
+const q = await getJSON('/queue'); 
+feed = Array.isArray(q.feeds) ? q.feeds.find(f=>f.course_id===course.id) : null; 
+if(!feed) break; 
+setBusyTextTextual(`${feed.lectures}/${feed.total || '…'}`); 
+qTick(true); 
+if(feed.state!=='pending' && feed.state!=='running') break; 
 } 
 qTick(true); 
-toast(t('toast.added_summary', {added, seen, skipped, exists})); 
-if(added===0 && exists>0 && skipped===0) toast(t('toast.course_done',{title: course.title})); 
+if(feed){ 
+if(feed.error) toast(feed.error); 
+toast(t('toast.added_summary', {added:feed.queued, seen:feed.lectures, skipped:0, exists:feed.skipped})); 
+if(feed.queued===0 && feed.skipped>0) toast(t('toast.course_done',{title: course.title})); 
+} 
 ensureCourseSize(course.id, preference); 
 } finally { hideBusy(); } 
 }
@@ -483,11 +359,12 @@ const byCourse = new Map();
 if(Array.isArray(data.courses)){
 for(const c of data.courses){
 const done=c.done|0, total=c.total|0;
-byCourse.set(c.course_id,{ course_id:c.course_id, title:c.title||'Course', done, total, state:(total>0&&done>=total)?'done':'queued', pct: total>0 ? Math.round((done*100)/total) : 0, _r:-1 });
+const failed=(c.failed|0)>0 && done<total; // failed jobs are archived, so /queue items no longer show them
+byCourse.set(c.course_id,{ course_id:c.course_id, title:c.title||'Course', done, total, state:failed?'failed':((total>0&&done>=total)?'done':'queued'), pct: total>0 ? Math.round((done*100)/total) : 0, _r:failed?4:-1 });
 }
 }
 if(Array.isArray(data.items)){
-const rank={downloading:4, failed:3, paused:2, queued:1, done:0};
+const rank={downloading:5, failed:4, retrying:3, paused:2, queued:1, done:0};
 for(const it of data.items){
 const row = byCourse.get(it.course_id); if(!row) continue;
 const st=String(it.state||'').toLowerCase(), r=rank[st]??0;
@@ -515,6 +392,7 @@ const sub = `${row.done}/${row.total} • %${pct}${sizeTxt}${speedTxt}`;
 const btn = row.state === 'paused'
     ? `<button class="btn sm" data-act="resume" data-cid="${row.course_id}">${t('actions.resume')}</button>`
     : `<button class="btn sm" data-act="pause" data-cid="${row.course_id}">${t('actions.pause')}</button>`;
+const cancelBtn = row.state === 'done' ? '' : `<button class="btn sm" data-act="cancel" data-cid="${row.course_id}">${t('actions.cancel')}</button>`;
 
 
 return `
@@ -524,7 +402,7 @@ return `
 <div class="q-sub">${sub}</div>
 <div class="bar"><i style="width:${pct}%"></i></div>
 </div>
-<div class="q-ctrl">${btn}</div>
+<div class="q-ctrl">${btn}${cancelBtn}</div>
 </div>`;
 }).join('');
 qList.innerHTML = rows;
@@ -552,7 +430,8 @@ if(__busy===0){
         for(const row of byCourse.values()){
             if(row.state==='downloading'){ statusKey='queue.downloading'; isDownloading=true; break; }
             if(row.state==='failed'){ statusKey='queue.failed'; break; }
-            if(row.state==='paused'){ statusKey='queue.paused'; }
+            if(row.state==='retrying'){ statusKey='queue.retrying'; }
+            else if(row.state==='paused' && statusKey!=='queue.retrying'){ statusKey='queue.paused'; }
         }
         run.innerHTML = isDownloading ? `<i class="spin"></i>${t(statusKey)}` : t(statusKey);
         qPill.style.display='';